@@ -273,7 +273,7 @@ char *MD5::hex_digest(){
 
   char *s= new char[33];
   for (i=0; i<16; i++)
-    sprintf(s+i*2, "%02x", digest[i]);
+    sprintf(s+i*2, "%02x", (unsigned char) digest[i]);
 
   s[32]='\0';
 
@@ -454,8 +454,10 @@ void MD5::decode (uint4 *output, uint1 *input, uint4 len){
   unsigned int i, j;
 
   for (i = 0, j = 0; j < len; i++, j += 4)
-    output[i] = ((uint4)input[j]) | (((uint4)input[j+1]) << 8) |
-      (((uint4)input[j+2]) << 16) | (((uint4)input[j+3]) << 24);
+    output[i] = ((uint4)(unsigned char)input[j]) |
+      (((uint4)(unsigned char)input[j+1]) << 8) |
+      (((uint4)(unsigned char)input[j+2]) << 16) |
+      (((uint4)(unsigned char)input[j+3]) << 24);
 }
 
 
@@ -50,6 +50,11 @@
 #include <vector>
 #include <queue>
 #include <limits>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include <cstring>
 
@@ -59,6 +64,23 @@
 #include <codecvt>
 #endif //POLE_USE_UTF16_FILENAMES
 
+#ifdef POLE_WIN
+// keep the min and max macros from shadowing std::min, std::max and numeric_limits<>::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //POLE_WIN
+
 // enable to activate debugging output
 // #define POLE_DEBUG
 #define CACHEBUFSIZE 4096 //a presumably reasonable size for the read cache
@@ -96,6 +118,8 @@ class AllocTable
     static const uint64 Avail;
     static const uint64 Bat;
     static const uint64 MetaBat;
+    static const uint64 MaxCachedBlocks;
+    typedef std::shared_ptr<const std::vector<uint64> > Chain;
     uint64 blockSize;
     AllocTable();
     void clear();
@@ -105,8 +129,9 @@ class AllocTable
     void preserve( uint64 n );
     void set( uint64 index, uint64 val );
     unsigned unused();
-    void setChain( std::vector<uint64> );
+    void setChain( const std::vector<uint64>& chain );
     std::vector<uint64> follow( uint64 start );
+    Chain chain( uint64 start );
     uint64 operator[](uint64 index );
     void load( const unsigned char* buffer, uint64 len );
     void save( unsigned char* buffer );
@@ -114,11 +139,15 @@ class AllocTable
     void debug();
     bool isDirty();
     void markAsDirty(uint64 dataIndex, int64 bigBlockSize);
-    void flush(std::vector<uint64> blocks, StorageIO *const io, int64 bigBlockSize);
+    void flush(const std::vector<uint64>& blocks, StorageIO *const io, int64 bigBlockSize);
   private:
     std::vector<uint64> data;
     std::vector<uint64> dirtyBlocks;
     bool bMaybeFragmented;
+    std::unordered_map<uint64, Chain> chainCache; // followed chains by start block
+    uint64 cachedBlocks;      // total length of the cached chains
+    std::mutex chainMutex;    // readers on several threads share the cache
+    void dropChains();
     AllocTable( const AllocTable& );
     AllocTable& operator=( const AllocTable& );
 };
@@ -150,6 +179,7 @@ class DirTree
     uint64 unusedEntryCount();
     DirEntry* entry( uint64 index );
     DirEntry* entry( const std::string& name, bool create = false, int64 bigBlockSize = 0, StorageIO *const io = 0, int64 streamSize = 0);
+    int64 lookup( const char* name, uint64 len );
     int64 indexOf( DirEntry* e );
     int64 parent( uint64 index );
     std::string fullName( uint64 index );
@@ -161,14 +191,27 @@ class DirTree
     void debug();
     bool isDirty();
     void markAsDirty(uint64 dataIndex, int64 bigBlockSize);
-    void flush(std::vector<uint64> blocks, StorageIO *const io, int64 bigBlockSize, uint64 sb_start, uint64 sb_size);
+    void flush(const std::vector<uint64>& blocks, StorageIO *const io, int64 bigBlockSize, uint64 sb_start, uint64 sb_size);
     uint64 unused();
     void findParentAndSib(uint64 inIdx, const std::string& inFullName, uint64 &parentIdx, uint64 &sibIdx);
     uint64 findSib(uint64 inIdx, uint64 sibIdx);
     void deleteEntry(DirEntry *entry, const std::string& inFullName, int64 bigBlockSize);
   private:
+    // one slot of the full path hash index, the path itself lives in pathPool
+    struct PathSlot
+    {
+        uint64 hash;
+        uint64 offset;
+        uint64 length;
+        int64 index;    // entry index, -1 for an empty slot
+    };
     std::vector<DirEntry> entries;
     std::vector<uint64> dirtyBlocks;
+    std::string pathPool;            // interned full names, without leading '/'
+    std::vector<PathSlot> pathIndex; // open addressing, empty when stale
+    void buildIndex();
+    void indexChildren( uint64 index, const std::string& prefix, std::vector<bool>& visited );
+    void insertPath( const std::string& path, uint64 index );
     DirTree( const DirTree& );
     DirTree& operator=( const DirTree& );
 };
@@ -179,6 +222,11 @@ class StorageIO
     Storage* storage;         // owner
     std::string filename;     // filename
     std::fstream file;        // associated with above name
+    const unsigned char* mapped; // read-only view of the whole file when memory mapped, 0 otherwise
+    int fd;                   // descriptor for positional reads of read-only files, -1 otherwise
+    std::mutex fileMutex;     // serializes seek+read on the fstream when there is no descriptor
+    const unsigned char* memory; // caller's buffer for in-memory storages, 0 for files
+    uint64 memorySize;        // size of the above
     int64 result;               // result of operation
     bool opened;              // true if file is opened
     uint64 filesize;   // size of the file
@@ -190,6 +238,14 @@ class StorageIO
     AllocTable* sbat;         // allocation table for small blocks
     
     std::vector<uint64> sb_blocks; // blocks for "small" files
+    std::vector<unsigned char> sb_data; // the small-file stream, materialized on first use
+    const unsigned char* sb_view; // contiguous view of the small-file stream
+    uint64 sb_size;           // bytes available through sb_view
+    std::atomic<bool> sb_loaded; // sb_view and sb_size are set
+    std::mutex sb_mutex;      // guards the first load of the small-file stream
+    std::vector<unsigned char*> cachePool; // getch() buffers given back by destroyed streams
+    std::mutex poolMutex;     // guards cachePool
+    std::atomic<uint64> readAllocations; // buffers allocated by the read path
     std::vector<uint64> mbat_blocks; // blocks for doubly indirect indices to big blocks
     std::vector<uint64> mbat_data; // the additional indices to big blocks
     bool mbatDirty;           // If true, mbat_blocks need to be written
@@ -197,12 +253,15 @@ class StorageIO
     std::list<Stream*> streams;
 
     StorageIO( Storage* storage, const char* filename );
+    StorageIO( Storage* storage, const unsigned char* data, uint64 size );
     ~StorageIO();
     
-    bool open(bool bWriteAccess = false, bool bCreate = false);
+    bool open(bool bWriteAccess = false, bool bCreate = false, bool bMapped = false);
     void close();
     void flush();
-    void load(bool bWriteAccess);
+    void load(bool bWriteAccess, bool bMapped = false);
+    bool mapFile();
+    void unmapFile();
     void create();
     void init();
     bool deleteByName(const std::string& fullName);
@@ -211,24 +270,40 @@ class StorageIO
 
     bool deleteLeaf(DirEntry *entry, const std::string& fullName);
 
-    uint64 loadBigBlocks( std::vector<uint64> blocks, unsigned char* buffer, uint64 maxlen );
+    uint64 readAt( uint64 pos, unsigned char* buffer, uint64 len );
+
+    uint64 chainBytes( const std::vector<uint64>& blocks, bool small );
+
+    uint64 loadBigBlocks( const std::vector<uint64>& blocks, unsigned char* buffer, uint64 maxlen );
+
+    uint64 loadBigBlockRuns( const uint64* blocks, uint64 count, uint64 offset, unsigned char* buffer, uint64 maxlen );
 
     uint64 loadBigBlock( uint64 block, unsigned char* buffer, uint64 maxlen );
 
-    uint64 saveBigBlocks( std::vector<uint64> blocks, uint64 offset, unsigned char* buffer, uint64 len );
+    uint64 saveBigBlocks( const std::vector<uint64>& blocks, uint64 offset, unsigned char* buffer, uint64 len );
 
     uint64 saveBigBlock( uint64 block, uint64 offset, unsigned char*buffer, uint64 len );
 
-    uint64 loadSmallBlocks( std::vector<uint64> blocks, unsigned char* buffer, uint64 maxlen );
+    uint64 loadSmallBlocks( const std::vector<uint64>& blocks, unsigned char* buffer, uint64 maxlen );
 
     uint64 loadSmallBlock( uint64 block, unsigned char* buffer, uint64 maxlen );
     
-    uint64 saveSmallBlocks( std::vector<uint64> blocks, uint64 offset, unsigned char* buffer, uint64 len, int64 startAtBlock = 0  );
+    uint64 saveSmallBlocks( const std::vector<uint64>& blocks, uint64 offset, unsigned char* buffer, uint64 len, int64 startAtBlock = 0  );
 
     uint64 saveSmallBlock( uint64 block, uint64 offset, unsigned char* buffer, uint64 len );
+
+    const unsigned char* miniStream();
+
+    unsigned char* acquireCache();
+
+    void releaseCache( unsigned char* cache );
+
+    void invalidateMiniStream();
     
     StreamIO* streamIO( const std::string& name, bool bCreate = false, int64 streamSize = 0 ); 
 
+    std::list<std::string> readStreams( const std::list<std::string>& names );
+
     void flushbbat();
 
     void flushsbat();
@@ -264,12 +339,16 @@ class StreamIO
     int64 getch();
     uint64 read( unsigned char* data, uint64 maxlen );
     uint64 read( uint64 pos, unsigned char* data, uint64 maxlen );
+    ByteSpan view();
+    std::list<Extent> extents();
     uint64 write( unsigned char* data, uint64 len );
     uint64 write( uint64 pos, unsigned char* data, uint64 len );
     void flush();
 
   private:
-    std::vector<uint64> blocks;
+    AllocTable::Chain chain;                     // shared with the allocation table's cache
+    std::shared_ptr<std::vector<uint64> > ownedChain; // private copy once the stream is modified
+    std::vector<uint64>& ownChain();
 
     // no copy or assign
     StreamIO( const StreamIO& );
@@ -278,6 +357,9 @@ class StreamIO
     // pointer for read
     uint64 m_pos;
 
+    // whole stream, when view() had to gather non-contiguous blocks
+    std::vector<unsigned char> view_data;
+
     // simple cache system to speed-up getch()
     unsigned char* cache_data;
     uint64 cache_size;
@@ -341,6 +423,15 @@ static inline void writeU32( unsigned char* ptr, uint32 data )
   ptr[3] = (unsigned char)((data >> 24) & 0xff);
 }
 
+// true if the first count blocks of the chain are physically consecutive
+static inline bool isContiguous( const std::vector<uint64>& blocks, uint64 count )
+{
+  if( count > blocks.size() ) return false;
+  for( uint64 i = 1; i < count; i++ )
+    if( blocks[i] != blocks[i-1] + 1 ) return false;
+  return true;
+}
+
 static const unsigned char pole_magic[] = 
  { 0xd0, 0xcf, 0x11, 0xe0, 0xa1, 0xb1, 0x1a, 0xe1 };
 
@@ -449,12 +540,16 @@ const uint64 AllocTable::Avail = 0xffffffff;
 const uint64 AllocTable::Eof = 0xfffffffe;
 const uint64 AllocTable::Bat = 0xfffffffd;
 const uint64 AllocTable::MetaBat = 0xfffffffc;
+const uint64 AllocTable::MaxCachedBlocks = 65536; // 512K worth of chain entries
 
 AllocTable::AllocTable()
 :   blockSize(4096),
     data(),
     dirtyBlocks(),
-    bMaybeFragmented(true)
+    bMaybeFragmented(true),
+    chainCache(),
+    cachedBlocks(0),
+    chainMutex()
 {
   // initial size
   resize( 128 );
@@ -479,6 +574,7 @@ uint64 AllocTable::unusedCount()
 
 void AllocTable::resize( uint64 newsize )
 {
+  dropChains();
   uint64 oldsize = static_cast<uint64>(data.size());
   data.resize( newsize );
   if( newsize > oldsize )
@@ -504,12 +600,13 @@ uint64 AllocTable::operator[]( uint64 index )
 void AllocTable::set( uint64 index, uint64 value )
 {
   if( index >= count() ) resize( index + 1);
+  dropChains();
   data[ index ] = value;
   if (value == Avail)
       bMaybeFragmented = true;
 }
 
-void AllocTable::setChain( std::vector<uint64> chain )
+void AllocTable::setChain( const std::vector<uint64>& chain )
 {
   if( chain.size() )
   {
@@ -541,6 +638,35 @@ std::vector<uint64> AllocTable::follow( uint64 start )
   return chain;
 }
 
+// same as follow, but memoized until the table changes
+AllocTable::Chain AllocTable::chain( uint64 start )
+{
+  std::lock_guard<std::mutex> lock( chainMutex );
+  std::unordered_map<uint64, Chain>::const_iterator it = chainCache.find( start );
+  if( it != chainCache.end() ) return it->second;
+
+  Chain result = std::make_shared<const std::vector<uint64> >( follow( start ) );
+  uint64 len = static_cast<uint64>(result->size());
+  if( len > MaxCachedBlocks ) return result;
+  if( cachedBlocks + len > MaxCachedBlocks )
+  {
+    chainCache.clear();
+    cachedBlocks = 0;
+  }
+  chainCache[start] = result;
+  cachedBlocks += len;
+  return result;
+}
+
+// only called while modifying the table, which is never concurrent with readers
+void AllocTable::dropChains()
+{
+  if( chainCache.empty() ) return;
+  std::lock_guard<std::mutex> lock( chainMutex );
+  chainCache.clear();
+  cachedBlocks = 0;
+}
+
 unsigned AllocTable::unused()
 {
   // find first available block
@@ -594,7 +720,7 @@ void AllocTable::markAsDirty(uint64 dataIndex, int64 bigBlockSize)
     dirtyBlocks.push_back(dbidx);
 }
 
-void AllocTable::flush(std::vector<uint64> blocks, StorageIO *const io, int64 bigBlockSize)
+void AllocTable::flush(const std::vector<uint64>& blocks, StorageIO *const io, int64 bigBlockSize)
 {
     unsigned char *buffer = new unsigned char[bigBlockSize * blocks.size()];
     save(buffer);
@@ -657,7 +783,9 @@ const uint64 DirTree::End = 0xffffffff;
 
 DirTree::DirTree(int64 bigBlockSize)
 :   entries(),
-    dirtyBlocks()
+    dirtyBlocks(),
+    pathPool(),
+    pathIndex()
 {
   clear(bigBlockSize);
 }
@@ -665,6 +793,8 @@ DirTree::DirTree(int64 bigBlockSize)
 void DirTree::clear(int64 bigBlockSize)
 {
   // leave only root entry
+  pathIndex.clear();
+  pathPool.clear();
   entries.resize( 1 );
   entries[0].valid = true;
   entries[0].name = "Root Entry";
@@ -701,10 +831,10 @@ DirEntry* DirTree::entry( uint64 index )
 
 int64 DirTree::indexOf( DirEntry* e )
 {
-  for( uint64 i = 0; i < entryCount(); i++ )
-    if( entry( i ) == e ) return i;
-    
-  return -1;
+  // entries are stored contiguously
+  if( !e || entries.empty() ) return -1;
+  if( e < &entries[0] || e > &entries[entryCount()-1] ) return -1;
+  return e - &entries[0];
 }
 
 int64 DirTree::parent( uint64 index )
@@ -755,6 +885,14 @@ DirEntry* DirTree::entry( const std::string& name, bool create, int64 bigBlockSi
  
    // quick check for "/" (that's root)
    if( name == "/" ) return entry( 0 );
+
+   // most lookups are answered by the path index built on load
+   if( !pathIndex.empty() )
+   {
+     int64 found = lookup( name.data(), name.length() );
+     if( found >= 0 ) return entry( found );
+     if( !create || !io->writeable ) return (DirEntry*)0;
+   }
    
    // split the names, e.g  "/ObjectPool/_1020961869" will become:
    // "ObjectPool" and "_1020961869" 
@@ -809,7 +947,8 @@ DirEntry* DirTree::entry( const std::string& name, bool create, int64 bigBlockSi
        // not found among children
        if( !create || !io->writeable) return (DirEntry*)0;
        
-       // create a new entry
+       // create a new entry, the path index no longer matches the tree
+       pathIndex.clear();
        uint64 parent2 = index;
        index = unused();
        DirEntry* e = entry( index );
@@ -970,6 +1109,95 @@ void DirTree::load( unsigned char* buffer, uint64 size )
     
     entries.push_back( e );
   }  
+
+  buildIndex();
+}
+
+static inline uint64 hashPath( const char* name, uint64 len )
+{
+  // FNV-1a
+  uint64 h = 14695981039346656037ULL;
+  for( uint64 i = 0; i < len; i++ )
+  {
+    h ^= (unsigned char) name[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// index every reachable entry by its full name, so lookups skip the sibling tree walk
+void DirTree::buildIndex()
+{
+  pathIndex.clear();
+  pathPool.clear();
+
+  uint64 slots = 16;
+  while( slots < entryCount() * 2 ) slots <<= 1;
+  PathSlot empty = { 0, 0, 0, -1 };
+  pathIndex.assign( slots, empty );
+
+  std::vector<bool> visited( entryCount(), false );
+  visited[0] = true;
+  indexChildren( 0, std::string(), visited );
+}
+
+void DirTree::indexChildren( uint64 index, const std::string& prefix, std::vector<bool>& visited )
+{
+  std::vector<uint64> chi = children( index );
+  for( unsigned i = 0; i < chi.size(); i++ )
+  {
+    uint64 c = chi[i];
+    // guard against broken files where siblings point back into the tree
+    if( c >= entryCount() || visited[c] ) continue;
+    visited[c] = true;
+    DirEntry* e = entry( c );
+    if( !e->valid || e->name.empty() ) continue;
+    std::string path = prefix + e->name;
+    insertPath( path, c );
+    if( e->dir )
+      indexChildren( c, path + "/", visited );
+  }
+}
+
+void DirTree::insertPath( const std::string& path, uint64 index )
+{
+  uint64 mask = pathIndex.size() - 1;
+  uint64 h = hashPath( path.data(), path.length() );
+  uint64 slot = h & mask;
+  while( pathIndex[slot].index >= 0 )
+  {
+    // keep the first entry for duplicate names, as the tree walk would
+    const PathSlot& ps = pathIndex[slot];
+    if( ps.hash == h && ps.length == path.length() && pathPool.compare( ps.offset, ps.length, path ) == 0 )
+      return;
+    slot = ( slot + 1 ) & mask;
+  }
+  PathSlot& ps = pathIndex[slot];
+  ps.hash = h;
+  ps.offset = pathPool.length();
+  ps.length = path.length();
+  ps.index = static_cast<int64>(index);
+  pathPool.append( path );
+}
+
+// find a full name in the path index, leading and trailing '/' are ignored.
+// returns the entry index or -1, never allocates
+int64 DirTree::lookup( const char* name, uint64 len )
+{
+  if( pathIndex.empty() ) return -1;
+  if( len && name[0] == '/' ) { name++; len--; }
+  if( len && name[len-1] == '/' ) len--;
+  if( !len ) return 0;
+
+  uint64 mask = pathIndex.size() - 1;
+  uint64 h = hashPath( name, len );
+  for( uint64 slot = h & mask; pathIndex[slot].index >= 0; slot = ( slot + 1 ) & mask )
+  {
+    const PathSlot& ps = pathIndex[slot];
+    if( ps.hash == h && ps.length == len && memcmp( pathPool.data() + ps.offset, name, len ) == 0 )
+      return ps.index;
+  }
+  return -1;
 }
 
 // return space required to save this dirtree
@@ -1046,7 +1274,7 @@ void DirTree::markAsDirty(uint64 dataIndex, int64 bigBlockSize)
     dirtyBlocks.push_back(dbidx);
 }
 
-void DirTree::flush(std::vector<uint64> blocks, StorageIO *const io, int64 bigBlockSize, uint64 sb_start, uint64 sb_size)
+void DirTree::flush(const std::vector<uint64>& blocks, StorageIO *const io, int64 bigBlockSize, uint64 sb_start, uint64 sb_size)
 {
     uint64 bufLen = size();
     unsigned char *buffer = new unsigned char[bufLen];
@@ -1193,6 +1421,7 @@ void DirTree::deleteEntry(DirEntry *dirToDel, const std::string& inFullName, int
     }
     dirToDel->valid = false; //indicating that this entry is not in use
     markAsDirty(inIdx, bigBlockSize);
+    pathIndex.clear();
 }
 
 
@@ -1226,6 +1455,10 @@ StorageIO::StorageIO( Storage* st, const char* fname )
 : storage(st),        
   filename(fname),
   file(), 
+  mapped(0),
+  fd(-1),
+  memory(0),
+  memorySize(0),
   result(Storage::Ok),        
   opened(false),        
   filesize(0),        
@@ -1235,6 +1468,45 @@ StorageIO::StorageIO( Storage* st, const char* fname )
   bbat(new AllocTable()),        
   sbat(new AllocTable()),
   sb_blocks(),
+  sb_data(),
+  sb_view(0),
+  sb_size(0),
+  sb_loaded(false),
+  cachePool(),
+  readAllocations(0),
+  mbat_blocks(),
+  mbat_data(),
+  mbatDirty(),
+  streams()
+{
+  bbat->blockSize = (uint64) 1 << header->b_shift;
+  sbat->blockSize = (uint64) 1 << header->s_shift;
+}
+
+// in-memory storage, read-only, the buffer must outlive the storage
+StorageIO::StorageIO( Storage* st, const unsigned char* data, uint64 size )
+: storage(st),        
+  filename(),
+  file(), 
+  mapped(0),
+  fd(-1),
+  memory(data),
+  memorySize(size),
+  result(Storage::Ok),        
+  opened(false),        
+  filesize(0),        
+  writeable(false),        
+  header(new Header()),        
+  dirtree(new DirTree(1 << header->b_shift)),        
+  bbat(new AllocTable()),        
+  sbat(new AllocTable()),
+  sb_blocks(),
+  sb_data(),
+  sb_view(0),
+  sb_size(0),
+  sb_loaded(false),
+  cachePool(),
+  readAllocations(0),
   mbat_blocks(),
   mbat_data(),
   mbatDirty(),
@@ -1247,18 +1519,26 @@ StorageIO::StorageIO( Storage* st, const char* fname )
 StorageIO::~StorageIO()
 {
   if( opened ) close();
+  for( uint64 i = 0; i < cachePool.size(); i++ )
+    delete[] cachePool[i];
   delete sbat;
   delete bbat;
   delete dirtree;
   delete header;
 }
 
-bool StorageIO::open(bool bWriteAccess, bool bCreate)
+bool StorageIO::open(bool bWriteAccess, bool bCreate, bool bMapped)
 {
   // already opened ? close first
   if (opened)
       close();
-  if (bCreate)
+  if (memory)
+  {
+      // nothing to write to, the buffer is used as if it were mapped
+      writeable = false;
+      load(false, true);
+  }
+  else if (bCreate)
   {
       create();
       init();
@@ -1267,13 +1547,13 @@ bool StorageIO::open(bool bWriteAccess, bool bCreate)
   else
   {
       writeable = bWriteAccess;
-      load(bWriteAccess);
+      load(bWriteAccess, bMapped && !bWriteAccess);
   }
   
   return result == Storage::Ok;
 }
 
-void StorageIO::load(bool bWriteAccess)
+void StorageIO::load(bool bWriteAccess, bool bMapped)
 {
   unsigned char* buffer = 0;
   uint64 buflen = 0;
@@ -1282,6 +1562,13 @@ void StorageIO::load(bool bWriteAccess)
   // open the file, check for error
   result = Storage::OpenFailed;
 
+  if( bMapped )
+  {
+    // read-only: every sector load becomes a copy out of the mapping
+    if( !mapFile() ) return;
+  }
+  else
+  {
 #if defined(POLE_USE_UTF16_FILENAMES)
   if (bWriteAccess)
       file.open(UTF8toUTF16(filename).c_str(), std::ios::binary | std::ios::in | std::ios::out);
@@ -1300,11 +1587,17 @@ void StorageIO::load(bool bWriteAccess)
   file.seekg(0, std::ios::end );
   filesize = static_cast<uint64>(file.tellg());
 
+#ifndef POLE_WIN
+  // read-only files are read with pread, so concurrent streams don't share a file position
+  if( !bWriteAccess )
+    fd = ::open( filename.c_str(), O_RDONLY );
+#endif //POLE_WIN
+  }
+
   // load header
   buffer = new unsigned char[512];
-  file.seekg( 0 ); 
-  file.read( (char*)buffer, 512 );
-  fileCheck(file);
+  memset( buffer, 0, 512 );
+  readAt( 0, buffer, 512 );
   header->load( buffer );
   delete[] buffer;
 
@@ -1359,6 +1652,7 @@ void StorageIO::load(bool bWriteAccess)
   
   // fetch block chain as data for small-files
   sb_blocks = bbat->follow( sb_start ); // small files
+  invalidateMiniStream();
   
   // for troubleshooting, just enable this block
 #if 0
@@ -1411,6 +1705,7 @@ void StorageIO::init()
     bbat->set(3, AllocTable::Eof);
     bbat->markAsDirty(3, bbat->blockSize);
     sb_blocks = bbat->follow( 3 );
+    invalidateMiniStream();
     mbatDirty = false;  
 }
 
@@ -1480,7 +1775,16 @@ void StorageIO::close()
 {
   if( !opened ) return;
   
-  file.close(); 
+  if( mapped )
+    unmapFile();
+  else
+    file.close(); 
+#ifndef POLE_WIN
+  if( fd >= 0 )
+    ::close( fd );
+#endif //POLE_WIN
+  fd = -1;
+  invalidateMiniStream();
   opened = false;
   
   std::list<Stream*>::iterator it;
@@ -1572,30 +1876,152 @@ bool StorageIO::deleteLeaf(DirEntry *entry, const std::string& fullName)
     return true;
 }
 
-uint64 StorageIO::loadBigBlocks( std::vector<uint64> blocks,
+// map the whole file read-only, filesize is taken from the mapping
+bool StorageIO::mapFile()
+{
+  if( memory )
+  {
+    mapped = memory;
+    filesize = memorySize;
+    return true;
+  }
+#ifdef POLE_WIN
+  HANDLE hFile = CreateFileW( UTF8toUTF16(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+  if( hFile == INVALID_HANDLE_VALUE ) return false;
+  LARGE_INTEGER len;
+  if( !GetFileSizeEx( hFile, &len ) || len.QuadPart <= 0 )
+  {
+    CloseHandle( hFile );
+    return false;
+  }
+  // the view keeps the mapping alive, so both handles can go right away
+  HANDLE hMap = CreateFileMappingW( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+  CloseHandle( hFile );
+  if( !hMap ) return false;
+  void* view = MapViewOfFile( hMap, FILE_MAP_READ, 0, 0, 0 );
+  CloseHandle( hMap );
+  if( !view ) return false;
+  filesize = static_cast<uint64>(len.QuadPart);
+#else
+  int fd = ::open( filename.c_str(), O_RDONLY );
+  if( fd < 0 ) return false;
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || st.st_size <= 0 )
+  {
+    ::close( fd );
+    return false;
+  }
+  // the mapping outlives the descriptor
+  void* view = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if( view == MAP_FAILED ) return false;
+  filesize = static_cast<uint64>(st.st_size);
+#endif //POLE_WIN
+  mapped = static_cast<const unsigned char*>(view);
+  return true;
+}
+
+void StorageIO::unmapFile()
+{
+  if( !mapped ) return;
+  if( mapped == memory )
+  {
+    // not ours
+    mapped = 0;
+    return;
+  }
+#ifdef POLE_WIN
+  UnmapViewOfFile( mapped );
+#else
+  munmap( const_cast<unsigned char*>(mapped), filesize );
+#endif //POLE_WIN
+  mapped = 0;
+}
+
+// the most a stream with this chain can hold: a directory entry may claim more, and
+// its size must not be trusted for an allocation before it is checked against this
+uint64 StorageIO::chainBytes( const std::vector<uint64>& blocks, bool small )
+{
+  uint64 limit = small ? sb_blocks.size() * bbat->blockSize : filesize;
+  uint64 bytes = blocks.size() * ( small ? sbat->blockSize : bbat->blockSize );
+  return std::min( bytes, limit );
+}
+
+// read len bytes at absolute file position pos, clamped to the end of the file
+uint64 StorageIO::readAt( uint64 pos, unsigned char* data, uint64 len )
+{
+  if( pos >= filesize ) return 0;
+  if( pos + len > filesize )
+    len = filesize - pos;
+
+  if( mapped )
+  {
+    memcpy( data, mapped + pos, len );
+    return len;
+  }
+
+#ifndef POLE_WIN
+  if( fd >= 0 )
+  {
+    uint64 done = 0;
+    while( done < len )
+    {
+      ssize_t got = pread( fd, data + done, len - done, pos + done );
+      if( got < 0 && errno == EINTR ) continue;
+      if( got <= 0 ) break;
+      done += got;
+    }
+    return done;
+  }
+#endif //POLE_WIN
+
+  std::lock_guard<std::mutex> lock( fileMutex );
+  fileCheck(file);
+  if( !file.good() ) return 0;
+  file.seekg( pos );
+  file.read( (char*)data, len );
+  fileCheck(file);
+  // should use gcount to see how many bytes were really returned - eof check...
+  return len;
+}
+
+uint64 StorageIO::loadBigBlocks( const std::vector<uint64>& blocks,
   unsigned char* data, uint64 maxlen )
 {
   // sentinel
   if( !data ) return 0;
-  fileCheck(file);
-  if( !file.good() ) return 0;
   if( blocks.size() < 1 ) return 0;
   if( maxlen == 0 ) return 0;
 
-  // read block one by one, seems fast enough
+  return loadBigBlockRuns( &blocks[0], blocks.size(), 0, data, maxlen );
+}
+
+// read up to maxlen bytes, starting offset bytes into the first of count blocks.
+// physically consecutive blocks are coalesced, so each run costs a single read.
+uint64 StorageIO::loadBigBlockRuns( const uint64* blocks, uint64 count, uint64 offset,
+  unsigned char* data, uint64 maxlen )
+{
   uint64 bytes = 0;
-  for( unsigned int i=0; (i < blocks.size() ) & ( bytes<maxlen ); i++ )
+  uint64 i = 0;
+  while( ( i < count ) && ( bytes < maxlen ) )
   {
-    uint64 block = blocks[i];
-    uint64 pos =  bbat->blockSize * ( block+1 );
-    uint64 p = (bbat->blockSize < maxlen-bytes) ? bbat->blockSize : maxlen-bytes;
-    if( pos + p > filesize )
-        p = filesize - pos;
-    file.seekg( pos );
-    file.read( (char*)data + bytes, p );
-    fileCheck(file);
-    // should use gcount to see how many bytes were really returned - eof check...
-    bytes += p;
+    // extend the run while the chain stays contiguous and more data is wanted
+    uint64 j = i + 1;
+    uint64 runlen = bbat->blockSize - offset;
+    while( ( j < count ) && ( runlen < maxlen-bytes ) && ( blocks[j] == blocks[j-1] + 1 ) )
+    {
+      runlen += bbat->blockSize;
+      j++;
+    }
+    if( runlen > maxlen-bytes ) runlen = maxlen-bytes;
+
+    uint64 pos = bbat->blockSize * ( blocks[i] + 1 ) + offset;
+    uint64 got = readAt( pos, data + bytes, runlen );
+    bytes += got;
+    if( got < runlen ) break;
+    offset = 0;
+    i = j;
   }
 
   return bytes;
@@ -1606,18 +2032,13 @@ uint64 StorageIO::loadBigBlock( uint64 block,
 {
   // sentinel
   if( !data ) return 0;
-  fileCheck(file);
-  if( !file.good() ) return 0;
   
-  // wraps call for loadBigBlocks
-  std::vector<uint64> blocks;
-  blocks.resize( 1 );
-  blocks[ 0 ] = block;
-  
-  return loadBigBlocks( blocks, data, maxlen );
+  if( maxlen == 0 ) return 0;
+
+  return loadBigBlockRuns( &block, 1, 0, data, maxlen );
 }
 
-uint64 StorageIO::saveBigBlocks( std::vector<uint64> blocks, uint64 offset, unsigned char* data, uint64 len )
+uint64 StorageIO::saveBigBlocks( const std::vector<uint64>& blocks, uint64 offset, unsigned char* data, uint64 len )
 {
   // sentinel
   if( !data ) return 0;
@@ -1663,41 +2084,28 @@ uint64 StorageIO::saveBigBlock( uint64 block, uint64 offset, unsigned char* data
 }
 
 // return number of bytes which has been read
-uint64 StorageIO::loadSmallBlocks( std::vector<uint64> blocks,
+uint64 StorageIO::loadSmallBlocks( const std::vector<uint64>& blocks,
   unsigned char* data, uint64 maxlen )
 {
   // sentinel
   if( !data ) return 0;
-  fileCheck(file);
-  if( !file.good() ) return 0;
   if( blocks.size() < 1 ) return 0;
   if( maxlen == 0 ) return 0;
 
-  // our own local buffer
-  unsigned char* buf = new unsigned char[ bbat->blockSize ];
+  const unsigned char* ministream = miniStream();
+  if( !ministream ) return 0;
 
-  // read small block one by one
+  // copy small block one by one out of the materialized small-file stream
   uint64 bytes = 0;
   for( unsigned int i=0; ( i<blocks.size() ) & ( bytes<maxlen ); i++ )
   {
-    uint64 block = blocks[i];
-
-    // find where the small-block exactly is
-    uint64 pos = block * sbat->blockSize;
-    uint64 bbindex = pos / bbat->blockSize;
-    if( bbindex >= sb_blocks.size() ) break;
-
-    loadBigBlock( sb_blocks[ bbindex ], buf, bbat->blockSize );
-
-    // copy the data
-    uint64 offset = pos % bbat->blockSize;
-    uint64 p = (maxlen-bytes < bbat->blockSize-offset ) ? maxlen-bytes :  bbat->blockSize-offset;
-    p = (sbat->blockSize<p ) ? sbat->blockSize : p;
-    memcpy( data + bytes, buf + offset, p );
+    uint64 pos = blocks[i] * sbat->blockSize;
+    if( pos >= sb_size ) break;
+    uint64 p = (maxlen-bytes < sbat->blockSize) ? maxlen-bytes : sbat->blockSize;
+    if( pos + p > sb_size ) p = sb_size - pos;
+    memcpy( data + bytes, ministream + pos, p );
     bytes += p;
   }
-  
-  delete[] buf;
 
   return bytes;
 }
@@ -1707,19 +2115,210 @@ uint64 StorageIO::loadSmallBlock( uint64 block,
 {
   // sentinel
   if( !data ) return 0;
-  fileCheck(file);
-  if( !file.good() ) return 0;
 
-  // wraps call for loadSmallBlocks
-  std::vector<uint64> blocks;
-  blocks.resize( 1 );
-  blocks.assign( 1, block );
+  if( maxlen == 0 ) return 0;
+
+  const unsigned char* ministream = miniStream();
+  if( !ministream ) return 0;
+
+  uint64 pos = block * sbat->blockSize;
+  if( pos >= sb_size ) return 0;
+  uint64 bytes = (maxlen < sbat->blockSize) ? maxlen : sbat->blockSize;
+  if( pos + bytes > sb_size ) bytes = sb_size - pos;
+  memcpy( data, ministream + pos, bytes );
+  return bytes;
+}
+
+
+// the small-file stream is read once per storage and kept as one contiguous buffer,
+// or pointed to directly when mapped and its big blocks follow each other
+const unsigned char* StorageIO::miniStream()
+{
+  if( sb_loaded.load( std::memory_order_acquire ) ) return sb_view;
+
+  // first reader loads it, the others wait
+  std::lock_guard<std::mutex> lock( sb_mutex );
+  if( sb_loaded.load( std::memory_order_relaxed ) ) return sb_view;
+  if( sb_blocks.empty() )
+  {
+    sb_loaded.store( true, std::memory_order_release );
+    return 0;
+  }
+
+  bool contiguous = isContiguous( sb_blocks, sb_blocks.size() );
+  uint64 len = static_cast<uint64>(sb_blocks.size()) * bbat->blockSize;
+  uint64 pos = bbat->blockSize * ( sb_blocks[0] + 1 );
+  if( mapped && contiguous && ( pos < filesize ) )
+  {
+    sb_size = ( pos + len > filesize ) ? filesize - pos : len;
+    sb_view = mapped + pos;
+  }
+  else
+  {
+    if( sb_data.capacity() < len ) readAllocations++;
+    sb_data.resize( len );
+    sb_size = loadBigBlocks( sb_blocks, &sb_data[0], len );
+    sb_view = sb_size ? &sb_data[0] : 0;
+  }
+  sb_loaded.store( true, std::memory_order_release );
+  return sb_view;
+}
 
-  return loadSmallBlocks( blocks, data, maxlen );
+// getch() buffers are recycled across the streams of a storage
+unsigned char* StorageIO::acquireCache()
+{
+  {
+    std::lock_guard<std::mutex> lock( poolMutex );
+    if( !cachePool.empty() )
+    {
+      unsigned char* cache = cachePool.back();
+      cachePool.pop_back();
+      return cache;
+    }
+  }
+  readAllocations++;
+  return new unsigned char[CACHEBUFSIZE];
+}
+
+void StorageIO::releaseCache( unsigned char* cache )
+{
+  std::lock_guard<std::mutex> lock( poolMutex );
+  cachePool.push_back( cache );
+}
+
+void StorageIO::invalidateMiniStream()
+{
+  sb_loaded.store( false );
+  sb_view = 0;
+  sb_size = 0;
+  sb_data.clear();
 }
 
+// one sector-sized piece of a requested stream
+struct SectorPiece
+{
+  uint64 pos;              // file offset
+  uint64 length;           // bytes to copy
+  uint64 stream;           // index of the requested stream
+  unsigned char* dest;     // where the bytes go
+  uint64 destOffset;       // offset of dest inside the stream
+  bool operator<( const SectorPiece& rhs ) const { return pos < rhs.pos; }
+};
+
+// read every named stream, visiting the sectors of all of them in ascending
+// file order so that a cold read costs one forward sweep instead of a seek per sector
+std::list<std::string> StorageIO::readStreams( const std::list<std::string>& names )
+{
+  std::list<std::string> contents;
+  std::vector<std::string*> results;
+  std::vector<uint64> valid;
+  std::vector<SectorPiece> pieces;
+
+  // small streams are copied right away if the mini stream is already in memory
+  const unsigned char* mini = sb_loaded.load( std::memory_order_acquire ) ? sb_view : 0;
+
+  std::list<std::string>::const_iterator it;
+  for( it = names.begin(); it != names.end(); ++it )
+  {
+    contents.push_back( std::string() );
+    std::string& data = contents.back();
+    results.push_back( &data );
+    valid.push_back( 0 );
+
+    DirEntry* entry = dirtree->entry( *it );
+    if( !entry || entry->dir || !entry->size ) continue;
+    uint64 stream = results.size() - 1;
+
+    bool small = entry->size < header->threshold;
+    AllocTable::Chain chain = small ? sbat->chain( entry->start ) : bbat->chain( entry->start );
+    uint64 blockSize = small ? sbat->blockSize : bbat->blockSize;
+    const std::vector<uint64>& blocks = *chain;
+
+    // a size beyond the chain yields a short stream, like a truncated file
+    uint64 size = std::min( entry->size, chainBytes( blocks, small ) );
+    if( !size ) continue;
+    data.resize( size );
+    valid[stream] = size;
+    unsigned char* dest = reinterpret_cast<unsigned char*>( &data[0] );
+
+    for( uint64 i = 0, offset = 0; offset < size; i++, offset += blockSize )
+    {
+      uint64 length = std::min( blockSize, size - offset );
+      uint64 pos;
+      if( i >= blocks.size() )
+      {
+        valid[stream] = offset;
+        break;
+      }
+      if( !small )
+        pos = bbat->blockSize * ( blocks[i] + 1 );
+      else
+      {
+        uint64 inMini = blocks[i] * sbat->blockSize;
+        if( mini )
+        {
+          if( inMini + length > sb_size )
+          {
+            valid[stream] = offset;
+            break;
+          }
+          memcpy( dest + offset, mini + inMini, length );
+          continue;
+        }
+        uint64 bbindex = inMini / bbat->blockSize;
+        if( bbindex >= sb_blocks.size() )
+        {
+          valid[stream] = offset;
+          break;
+        }
+        pos = bbat->blockSize * ( sb_blocks[ bbindex ] + 1 ) + inMini % bbat->blockSize;
+      }
+      SectorPiece piece = { pos, length, stream, dest + offset, offset };
+      pieces.push_back( piece );
+    }
+  }
+
+  std::sort( pieces.begin(), pieces.end() );
+
+  // adjacent pieces are read together, then scattered to their streams
+  std::vector<unsigned char> run;
+  for( uint64 i = 0; i < pieces.size(); )
+  {
+    uint64 j = i + 1;
+    uint64 runlen = pieces[i].length;
+    while( !mapped && ( j < pieces.size() ) && ( pieces[j].pos == pieces[i].pos + runlen ) )
+      runlen += pieces[j++].length;
+
+    uint64 got;
+    if( j == i + 1 )
+      got = readAt( pieces[i].pos, pieces[i].dest, runlen );
+    else
+    {
+      run.resize( runlen );
+      got = readAt( pieces[i].pos, &run[0], runlen );
+    }
+
+    for( uint64 k = i, at = 0; k < j; at += pieces[k].length, k++ )
+    {
+      const SectorPiece& piece = pieces[k];
+      uint64 copied = ( got > at ) ? std::min( piece.length, got - at ) : 0;
+      if( j != i + 1 && copied )
+        memcpy( piece.dest, &run[at], copied );
+      if( copied < piece.length )
+        valid[piece.stream] = std::min( valid[piece.stream], piece.destOffset + copied );
+    }
+    i = j;
+  }
 
-uint64 StorageIO::saveSmallBlocks( std::vector<uint64> blocks, uint64 offset, 
+  // a truncated file yields the readable prefix, as Stream::read would
+  for( uint64 i = 0; i < results.size(); i++ )
+    if( valid[i] < results[i]->size() )
+      results[i]->resize( valid[i] );
+
+  return contents;
+}
+
+uint64 StorageIO::saveSmallBlocks( const std::vector<uint64>& blocks, uint64 offset, 
                                         unsigned char* data, uint64 len, int64 startAtBlock )
 {
   // sentinel
@@ -1729,6 +2328,9 @@ uint64 StorageIO::saveSmallBlocks( std::vector<uint64> blocks, uint64 offset,
   if( blocks.size() < 1 ) return 0;
   if( len == 0 ) return 0;
 
+  // the cached small-file stream goes stale
+  invalidateMiniStream();
+
   // write block one by one, seems fast enough
   uint64 bytes = 0;
   for( uint64 i = startAtBlock; (i < blocks.size() ) & ( bytes<len ); i++ )
@@ -1896,24 +2498,37 @@ StreamIO::StreamIO( StorageIO* s, DirEntry* e)
 :   io(s),
     entryIdx(io->dirtree->indexOf(e)),
     fullName(),
-    blocks(),
     eof(false),
     fail(false),
+    chain(),
+    ownedChain(),
     m_pos(0),
-    cache_data(new unsigned char[CACHEBUFSIZE]),        
+    view_data(),
+    cache_data(0),         // taken from the storage's pool on first getch()
     cache_size(0),         // indicating an empty cache
     cache_pos(0)
 {
   if( e->size >= io->header->threshold ) 
-    blocks = io->bbat->follow( e->start );
+    chain = io->bbat->chain( e->start );
   else
-    blocks = io->sbat->follow( e->start );
+    chain = io->sbat->chain( e->start );
+}
+
+// chains come from the allocation table's cache, copy before changing one
+std::vector<uint64>& StreamIO::ownChain()
+{
+  if( !ownedChain )
+  {
+    ownedChain = std::make_shared<std::vector<uint64> >( *chain );
+    chain = ownedChain;
+  }
+  return *ownedChain;
 }
 
 // FIXME tell parent we're gone
 StreamIO::~StreamIO()
 {
-  delete[] cache_data;  
+  if( cache_data ) io->releaseCache( cache_data );
 }
 
 void StreamIO::setSize(uint64 newSize)
@@ -1924,6 +2539,7 @@ void StreamIO::setSize(uint64 newSize)
     if(!io->writeable )
         return;
     DirEntry *entry = io->dirtree->entry(entryIdx);
+    std::vector<uint64>& blocks = ownChain();
     if (newSize >= io->header->threshold && entry->size < io->header->threshold)
     {
         bThresholdCrossed = true;
@@ -2025,7 +2641,10 @@ uint64 StreamIO::read( uint64 pos, unsigned char* data, uint64 maxlen )
 
   uint64 totalbytes = 0;
   
+  const std::vector<uint64>& blocks = *chain;
   DirEntry *entry = io->dirtree->entry(entryIdx);
+  if (pos >= entry->size)
+      return 0;
   if (pos + maxlen > entry->size)
       maxlen = entry->size - pos;
   if ( entry->size < io->header->threshold )
@@ -2035,20 +2654,24 @@ uint64 StreamIO::read( uint64 pos, unsigned char* data, uint64 maxlen )
 
     if( index >= blocks.size() ) return 0;
 
-    unsigned char* buf = new unsigned char[ io->sbat->blockSize ];
+    const unsigned char* ministream = io->miniStream();
+    if( !ministream ) return 0;
+
+    // plain copies out of the small-file stream
     uint64 offset = pos % io->sbat->blockSize;
     while( totalbytes < maxlen )
     {
       if( index >= blocks.size() ) break;
-      io->loadSmallBlock( blocks[index], buf, io->bbat->blockSize );
+      uint64 sbpos = blocks[index] * io->sbat->blockSize + offset;
+      if( sbpos >= io->sb_size ) break;
       uint64 count = io->sbat->blockSize - offset;
       if( count > maxlen-totalbytes ) count = maxlen-totalbytes;
-      memcpy( data+totalbytes, buf + offset, count );
+      if( sbpos + count > io->sb_size ) count = io->sb_size - sbpos;
+      memcpy( data+totalbytes, ministream + sbpos, count );
       totalbytes += count;
       offset = 0;
       index++;
     }
-    delete[] buf;
 
   }
   else
@@ -2058,24 +2681,88 @@ uint64 StreamIO::read( uint64 pos, unsigned char* data, uint64 maxlen )
     
     if( index >= blocks.size() ) return 0;
     
-    unsigned char* buf = new unsigned char[ io->bbat->blockSize ];
+    // copy straight into the caller's buffer, one read per contiguous run
     uint64 offset = pos % io->bbat->blockSize;
-    while( totalbytes < maxlen )
+    totalbytes = io->loadBigBlockRuns( &blocks[index], blocks.size() - index, offset, data, maxlen );
+  }
+
+  return totalbytes;
+}
+
+ByteSpan StreamIO::view()
+{
+  const std::vector<uint64>& blocks = *chain;
+  DirEntry *entry = io->dirtree->entry(entryIdx);
+  uint64 len = entry->size;
+  if( len == 0 ) return ByteSpan();
+  bool small = len < io->header->threshold;
+
+  // a size beyond the chain marks a bad stream: only what the chain holds is returned
+  uint64 readable = io->chainBytes( blocks, small );
+  if( len > readable )
+  {
+    fail = true;
+    len = readable;
+    if( len == 0 ) return ByteSpan();
+  }
+
+  if( small )
+  {
+    // small file: a slice of the small-file stream if its small blocks follow each other
+    uint64 count = ( len + io->sbat->blockSize - 1 ) / io->sbat->blockSize;
+    const unsigned char* ministream = io->miniStream();
+    if( ministream && isContiguous( blocks, count ) && blocks[0] * io->sbat->blockSize + len <= io->sb_size )
+      return ByteSpan( ministream + blocks[0] * io->sbat->blockSize, len );
+  }
+  else if( io->mapped )
+  {
+    // big file: a slice of the mapping if its big blocks follow each other
+    uint64 count = ( len + io->bbat->blockSize - 1 ) / io->bbat->blockSize;
+    uint64 pos = io->bbat->blockSize * ( blocks.empty() ? 0 : blocks[0] + 1 );
+    if( isContiguous( blocks, count ) && pos + len <= io->filesize )
+      return ByteSpan( io->mapped + pos, len );
+  }
+
+  // gather everything once
+  if( view_data.size() != len )
+  {
+    if( view_data.capacity() < len ) io->readAllocations++;
+    view_data.resize( len );
+    view_data.resize( read( 0, &view_data[0], len ) );
+  }
+  return ByteSpan( view_data.empty() ? 0 : &view_data[0], view_data.size() );
+}
+
+std::list<Extent> StreamIO::extents()
+{
+  std::list<Extent> result;
+  const std::vector<uint64>& blocks = *chain;
+  DirEntry *entry = io->dirtree->entry(entryIdx);
+  bool small = entry->size < io->header->threshold;
+  uint64 blockSize = small ? io->sbat->blockSize : io->bbat->blockSize;
+
+  for( uint64 i = 0, done = 0; ( done < entry->size ) && ( i < blocks.size() ); i++, done += blockSize )
+  {
+    uint64 length = std::min( blockSize, entry->size - done );
+    uint64 pos;
+    if( !small )
+      pos = io->bbat->blockSize * ( blocks[i] + 1 );
+    else
     {
-      if( index >= blocks.size() ) break;
-      io->loadBigBlock( blocks[index], buf, io->bbat->blockSize );
-      uint64 count = io->bbat->blockSize - offset;
-      if( count > maxlen-totalbytes ) count = maxlen-totalbytes;
-      memcpy( data+totalbytes, buf + offset, count );
-      totalbytes += count;
-      index++;
-      offset = 0;
+      // small blocks live inside the big blocks of the small-file stream
+      uint64 inMini = blocks[i] * io->sbat->blockSize;
+      uint64 bbindex = inMini / io->bbat->blockSize;
+      if( bbindex >= io->sb_blocks.size() ) break;
+      pos = io->bbat->blockSize * ( io->sb_blocks[ bbindex ] + 1 ) + inMini % io->bbat->blockSize;
     }
-    delete [] buf;
+    if( pos + length > io->filesize ) break;
 
+    if( !result.empty() && ( result.back().offset + result.back().length == pos ) )
+      result.back().length += length;
+    else
+      result.push_back( Extent( pos, length ) );
   }
-
-  return totalbytes;
+  return result;
 }
 
 uint64 StreamIO::read( unsigned char* data, uint64 maxlen )
@@ -2097,9 +2784,11 @@ uint64 StreamIO::write( uint64 pos, unsigned char* data, uint64 len )
   if( len == 0 ) return 0;
   if( !io->writeable ) return 0;
 
+  view_data.clear();
   DirEntry *entry = io->dirtree->entry(entryIdx);
   if (pos + len > entry->size)
       setSize(pos + len); //reset size, possibly changing from small to large blocks
+  std::vector<uint64>& blocks = ownChain();
   uint64 totalbytes = 0;
   if ( entry->size < io->header->threshold )
   {
@@ -2129,6 +2818,7 @@ uint64 StreamIO::write( uint64 pos, unsigned char* data, uint64 len )
         while (sidx >= io->sb_blocks.size()) 
         {
             io->ExtendFile(&io->sb_blocks);
+            io->invalidateMiniStream();
             io->dirtree->markAsDirty(0, io->bbat->blockSize); //make sure to rewrite first directory block
         }
     }
@@ -2174,8 +2864,7 @@ void StreamIO::flush()
 
 void StreamIO::updateCache()
 {
-  // sanity check
-  if( !cache_data ) return;
+  if( !cache_data ) cache_data = io->acquireCache();
 
   DirEntry *entry = io->dirtree->entry(entryIdx);
   cache_pos = m_pos - (m_pos % CACHEBUFSIZE);
@@ -2192,6 +2881,11 @@ Storage::Storage( const char* filename )
   io = new StorageIO( this, filename );
 }
 
+Storage::Storage( const unsigned char* data, uint64 size )
+{
+  io = new StorageIO( this, data, size );
+}
+
 Storage::~Storage()
 {
   delete io;
@@ -2207,6 +2901,11 @@ bool Storage::open(bool bWriteAccess, bool bCreate)
   return io->open(bWriteAccess, bCreate);
 }
 
+bool Storage::openMapped()
+{
+  return io->open(false, false, true);
+}
+
 void Storage::close()
 {
   io->close();
@@ -2292,6 +2991,11 @@ std::list<std::string> Storage::GetAllStreams( const std::string& storageName )
   return vresult;
 }
 
+std::list<std::string> Storage::readStreams( const std::list<std::string>& names )
+{
+  return io->readStreams( names );
+}
+
 const std::filebuf* Storage::bytes() const
 {
     return io->file.rdbuf();
@@ -2302,6 +3006,21 @@ std::fstream& Storage::internalFile() const
     return io->file;
 }
 
+const unsigned char* Storage::mappedBytes() const
+{
+    return io->mapped;
+}
+
+uint64 Storage::fileSize() const
+{
+    return io->filesize;
+}
+
+uint64 Storage::readAllocations() const
+{
+    return io->readAllocations;
+}
+
 // =========== Stream ==========
 
 Stream::Stream( Storage* storage, const std::string& name, bool bCreate, int64 streamSize )
@@ -2360,6 +3079,16 @@ uint64 Stream::read( unsigned char* data, uint64 maxlen )
   return io ? io->read( data, maxlen ) : 0;
 }
 
+ByteSpan Stream::view()
+{
+  return io ? io->view() : ByteSpan();
+}
+
+std::list<Extent> Stream::extents()
+{
+  return io ? io->extents() : std::list<Extent>();
+}
+
 uint64 Stream::write( unsigned char* data, uint64 len )
 {
     return io ? io->write( data, len ) : 0;
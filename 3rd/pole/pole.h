@@ -90,6 +90,34 @@ class StorageIO;
 class Stream;
 class StreamIO;
 
+/**
+ * A contiguous, read-only run of bytes owned by a Storage or a Stream.
+ **/
+class ByteSpan
+{
+public:
+  ByteSpan() : data( 0 ), size( 0 ) {}
+  ByteSpan( const unsigned char* d, uint64 len ) : data( d ), size( len ) {}
+
+  const unsigned char* begin() const { return data; }
+  const unsigned char* end() const { return data + size; }
+  bool empty() const { return size == 0; }
+
+  const unsigned char* data;
+  uint64 size;
+};
+
+// a run of bytes inside the storage file
+class Extent
+{
+public:
+  Extent() : offset( 0 ), length( 0 ) {}
+  Extent( uint64 off, uint64 len ) : offset( off ), length( len ) {}
+
+  uint64 offset;
+  uint64 length;
+};
+
 class Storage
 {
   friend class Stream;
@@ -105,6 +133,13 @@ public:
    **/
   Storage( const char* filename );
 
+  /**
+   * Constructs a read-only storage over size bytes at data, e.g. a
+   * structured storage file already loaded in memory. The buffer is not
+   * copied and must outlive the storage.
+   **/
+  Storage( const unsigned char* data, uint64 size );
+
   /**
    * Destroys the storage.
    **/
@@ -115,6 +150,13 @@ public:
    **/
   bool open(bool bWriteAccess = false, bool bCreate = false);
 
+  /**
+   * Opens the storage read-only through a memory mapping of the whole file,
+   * so sector loads and stream reads copy straight from the mapped pages.
+   * Returns true if no error occurs.
+   **/
+  bool openMapped();
+
   /**
    * Closes the storage.
    **/
@@ -162,6 +204,13 @@ public:
       uint64 *pSmallBlocks, uint64 *pUnusedSmallBlocks);
 
   std::list<std::string> GetAllStreams( const std::string& storageName );
+
+  /**
+   * Reads the whole contents of each named stream, in the same order as
+   * names. The sectors of all the streams are read in ascending file order,
+   * in a single pass. Missing entries and directories yield an empty string.
+   */
+  std::list<std::string> readStreams( const std::list<std::string>& names );
   
   /**
    * @brief ..Rertunrs internal fstream rdbuf() data for raw reading.
@@ -170,6 +219,25 @@ public:
    const std::filebuf* bytes() const;
    std::fstream& internalFile() const;
 
+  /**
+   * Returns the raw file contents when opened with openMapped() or built
+   * over a memory buffer, 0 otherwise.
+   */
+  const unsigned char* mappedBytes() const;
+
+  /**
+   * Returns the size in bytes of the underlying file.
+   */
+  uint64 fileSize() const;
+
+  /**
+   * Returns how many buffers the read path has allocated since the storage
+   * was created. Reading streams of an open storage does not allocate, so
+   * this only grows while the small-file stream, getch() caches and
+   * non-contiguous views are first set up.
+   */
+  uint64 readAllocations() const;
+
 private:
   StorageIO* io;
   
@@ -188,6 +256,9 @@ public:
 
   /**
    * Creates a new stream.
+   * Streams of a storage opened read-only may be read concurrently from
+   * several threads, as long as each thread uses its own Stream object.
+   * Writing is not thread-safe.
    */
   // name must be absolute, e.g "/Workbook"
   Stream( Storage* storage, const std::string& name, bool bCreate = false, int64 streamSize = 0);
@@ -233,6 +304,21 @@ public:
    * Reads a block of data.
    **/
   uint64 read( unsigned char* data, uint64 maxlen );
+
+  /**
+   * Returns the whole stream as one contiguous read-only span, without
+   * touching the read position. When the stream's blocks are contiguous it
+   * points straight into the mapping (or the cached small-file stream),
+   * otherwise into a buffer owned by this stream. The span stays valid until
+   * the stream is destroyed, written to, or the storage is closed.
+   **/
+  ByteSpan view();
+
+  /**
+   * Returns where the stream's bytes lie in the storage file, in stream
+   * order. Physically adjacent sectors are merged into one extent.
+   **/
+  std::list<Extent> extents();
   
   /**
    * Writes a block of data.
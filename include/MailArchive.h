@@ -23,7 +23,10 @@
 #define MAILARCHIVE_H
 
 // std
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 // Qt
 #include <QString>
@@ -32,12 +35,23 @@
 
 // Local
 #include "msg.h"
+#include "utils.h"
 #include "MailListModel.h"
 
 class MailArchive
 {
   private:
     unsigned int transactionCounter;
+    uint64_t m_BytesRead; // .msg bytes loaded from disk while archiving, for I/O reporting
+
+    // Algorithm of the message and attachment keys. Archives from before it was recorded stay on MD5
+    // until migrateHashes() has rekeyed every row to m_MigrationAlgorithm.
+    Utils::HashAlgorithm m_HashAlgorithm;
+    Utils::HashAlgorithm m_MigrationAlgorithm;
+    bool m_MigratingHashes; // rows may carry either key: lookups check both
+    bool m_RekeyPending;    // rows left for migrateHashes() to visit this session
+    bool m_BackfillingRecipients; // messages archived before the recipients table still lack rows
+    bool m_ContentDedupe; // duplicates detected by Msg::contentHash() rather than by the file hash
 
     QString baseFileName;
     QString m_Path;
@@ -50,11 +64,29 @@ class MailArchive
 
     QSqlDatabase db;
 
+    void insertRecipients(const QString& messageId, const std::vector<Core::Recipient>& recipients);
+    std::string storeAttachments(const QString& messageId, Core::Msg& msgFile, const Core::MsgRecord& rec);
+    std::string restoreMsgBytes(const QString& messageId);
+    QString setting(const QString& name);
+    void setSetting(const QString& name, const QString& value);
+    void loadHashAlgorithm();
+    bool containsMsg(const QString& messageId, const QString& migratedId, const QString& contentKey);
+    void rekeyMsg(const QString& oldId, const QString& newId);
+    void deleteMsgRows(const QString& id);
+    void insertContentKey(const QString& messageId, const QString& contentKey);
+
   public:
     void refreshQueries();
 
     enum class SearchPattern { NoSearch, FullMessage, Body, Subject, From, To };
 
+    struct DuplicateReport
+    {
+        qlonglong messages;   // archived messages
+        qlonglong duplicates; // messages whose content is already archived under another file hash
+        qlonglong groups;     // distinct contents archived more than once
+    };
+
   public:
     MailArchive() = default;
     explicit MailArchive(const QString& filename);
@@ -65,6 +97,7 @@ class MailArchive
     const QString& activeTag() { return m_ActiveTag; }
     const QString& path() { return m_Path; }
     const QString& fileName() { return baseFileName; }
+    uint64_t bytesRead() { return m_BytesRead; }
 
     MailListModel* emails() { return m_Emails.get(); }
     QSqlQueryModel* folders() { return m_Folders.get(); }
@@ -80,6 +113,21 @@ class MailArchive
     void saveMsgAsFile(const QString& messageId, const QString& fileName);
     void deleteMsg(const QString& id);
 
+    // Rekeys up to batchSize messages archived under the legacy hash. Meant to be called repeatedly
+    // while idle; returns whether messages are left to visit in this session.
+    bool migrateHashes(int batchSize);
+    bool hashMigrationPending() { return m_RekeyPending; }
+
+    // Fills the recipients of up to batchSize messages archived before the recipients table, in
+    // the same way; returns whether messages are left. Address searches scan until it is done.
+    bool backfillRecipients(int batchSize);
+    bool recipientBackfillPending() { return m_BackfillingRecipients; }
+
+    bool contentDedupe() { return m_ContentDedupe; }
+    void setContentDedupe(bool enabled);
+    // Computes the content key of every message lacking one and counts the duplicates they reveal
+    DuplicateReport contentDuplicateReport();
+
     // Move semantics
     MailArchive(MailArchive&& rhs) = default;
     MailArchive& operator=(MailArchive&& rhs) = default;
@@ -35,6 +35,7 @@ class MailListDelegate;
 class MailListModel;
 class QModelIndex;
 class QKeyEvent;
+class QTimer;
 
 class MailArchiverWidget : public QMainWindow
 {
@@ -65,6 +66,7 @@ class MailArchiverWidget : public QMainWindow
     void onOpenArchive();
     void onArchiveEmails();
     void onArchiveEntireFolder();
+    void onFindDuplicates();
     void onSearchButtonClicked();
     void onButtonGroupPressed(int id);
     void onSearchLineChanged(const QString& text);
@@ -82,11 +84,18 @@ class MailArchiverWidget : public QMainWindow
     // slot for restarting the application.
     void onRestartApplication();
 
+    // Rekeys a batch of messages of archives still keyed by a legacy hash, whenever the UI is idle.
+    void onHashBackfill();
+    // Fills the recipients index of archives created before it, in the same way.
+    void onRecipientBackfill();
+
   private:
     QMenu* ctxMenu;
     Ui::MailArchiverWidget* ui;
     MailListDelegate* delegate;
     ArchiveManager* archiveMgr;
+    QTimer* hashBackfill;
+    QTimer* recipientBackfill;
 };
 
 #endif // MAILARCHIVERWIDGET_H
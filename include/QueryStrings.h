@@ -32,6 +32,46 @@ class QueryStrings
     static const QString CreateTagsTable;
     static const QString CreateFolderRelsTable;
     static const QString CreateTagRelsTable;
+    static const QString SelectRecipientsTable;
+    static const QString CreateRecipientsTable;
+    static const QString CreateRecipientsAddressIndex;
+    static const QString CreateRecipientsMessageIndex;
+    static const QString SelectLastMailRow;
+    static const QString SelectMessageIdsInRows;
+    static const QString InsertRecipient;
+    static const QString DeleteMailRecipients;
+    static const QString CreateAttachmentsTable;
+    static const QString CreateAttachmentRefsTable;
+    static const QString CreateAttachmentRefsMessageIndex;
+    static const QString CreateAttachmentRefsHashIndex;
+    static const QString SelectCountOfAttachments;
+    static const QString InsertAttachment;
+    static const QString InsertAttachmentRef;
+    static const QString SelectAttachmentRefs;
+    static const QString DeleteMailAttachmentRefs;
+    static const QString DeleteOrphanAttachments;
+    static const QString BeginMailSavepoint;
+    static const QString ReleaseMailSavepoint;
+    static const QString RollbackMailSavepoint;
+    static const QString CreateSettingsTable;
+    static const QString SelectSetting;
+    static const QString UpdateSetting;
+    static const QString DeleteSetting;
+    static const QString SelectCountOfAllMails;
+    static const QString SelectMessageIdsAfterRow;
+    static const QString RekeyMail;
+    static const QString RekeyFolderRels;
+    static const QString RekeyTagRels;
+    static const QString RekeyMailRecipients;
+    static const QString RekeyMailAttachmentRefs;
+    static const QString CreateContentKeysTable;
+    static const QString CreateContentKeysHashIndex;
+    static const QString SelectCountOfContentKeys;
+    static const QString InsertContentKey;
+    static const QString DeleteMailContentKey;
+    static const QString RekeyMailContentKeys;
+    static const QString SelectMessageIdsWithoutContentKey;
+    static const QString SelectContentDuplicates;
     static const QString SelectCountOfMails;
     static const QString InsertNewMail;
     static const QString TryClearSQLiteState;
@@ -43,6 +83,7 @@ class QueryStrings
     static const QString SearchSubjectPattern;
     static const QString SearchFromPattern;
     static const QString SearchToPattern;
+    static const QString SearchToAddress;
 };
 
 const QString QueryStrings::SelectAllFolders = QStringLiteral("SELECT * FROM MailFolders");
@@ -73,6 +114,89 @@ const QString QueryStrings::CreateTagRelsTable = QStringLiteral("CREATE TABLE IF
                                                                 "KEY NOT NULL, TID "
                                                                 "INTEGER NOT NULL, "
                                                                 "MID VARCHAR(32) NOT NULL)");
+const QString QueryStrings::SelectRecipientsTable = QStringLiteral("SELECT name FROM sqlite_master WHERE "
+                                                                   "type='table' AND name='MailRecipients'");
+const QString QueryStrings::CreateRecipientsTable =
+    QStringLiteral("CREATE TABLE IF NOT EXISTS MailRecipients ("
+                   "MESSAGEID VARCHAR(32) NOT NULL, RTYPE INTEGER NOT NULL, "
+                   "NAME TEXT, ADDRESS TEXT)");
+const QString QueryStrings::CreateRecipientsAddressIndex =
+    QStringLiteral("CREATE INDEX IF NOT EXISTS MailRecipientsAddress ON "
+                   "MailRecipients (ADDRESS COLLATE NOCASE)");
+const QString QueryStrings::CreateRecipientsMessageIndex =
+    QStringLiteral("CREATE INDEX IF NOT EXISTS MailRecipientsMessage ON MailRecipients (MESSAGEID)");
+const QString QueryStrings::SelectLastMailRow = QStringLiteral("SELECT MAX(ROWID) FROM MailArchive");
+const QString QueryStrings::SelectMessageIdsInRows = QStringLiteral(
+    "SELECT ROWID, MESSAGEID FROM MailArchive WHERE ROWID > ? AND ROWID <= ? ORDER BY ROWID LIMIT ?");
+const QString QueryStrings::InsertRecipient =
+    QStringLiteral("INSERT INTO MailRecipients (MESSAGEID, RTYPE, NAME, ADDRESS) VALUES (?,?,?,?)");
+const QString QueryStrings::DeleteMailRecipients =
+    QStringLiteral("DELETE FROM MailRecipients WHERE MESSAGEID=?");
+const QString QueryStrings::CreateAttachmentsTable =
+    QStringLiteral("CREATE TABLE IF NOT EXISTS MailAttachments ("
+                   "HASH VARCHAR(32) PRIMARY KEY NOT NULL, SIZE INTEGER, CONTENT BLOB)");
+const QString QueryStrings::CreateAttachmentRefsTable =
+    QStringLiteral("CREATE TABLE IF NOT EXISTS MailAttachmentRefs ("
+                   "MESSAGEID VARCHAR(32) NOT NULL, STORAGE TEXT NOT NULL, "
+                   "HASH VARCHAR(32) NOT NULL, FILENAME TEXT)");
+const QString QueryStrings::CreateAttachmentRefsMessageIndex =
+    QStringLiteral("CREATE INDEX IF NOT EXISTS MailAttachmentRefsMessage ON MailAttachmentRefs (MESSAGEID)");
+const QString QueryStrings::CreateAttachmentRefsHashIndex =
+    QStringLiteral("CREATE INDEX IF NOT EXISTS MailAttachmentRefsHash ON MailAttachmentRefs (HASH)");
+const QString QueryStrings::SelectCountOfAttachments =
+    QStringLiteral("SELECT COUNT(HASH) FROM MailAttachments WHERE HASH=?");
+const QString QueryStrings::InsertAttachment =
+    QStringLiteral("INSERT INTO MailAttachments (HASH, SIZE, CONTENT) VALUES (?,?,?)");
+const QString QueryStrings::InsertAttachmentRef =
+    QStringLiteral("INSERT INTO MailAttachmentRefs (MESSAGEID, STORAGE, HASH, FILENAME) VALUES (?,?,?,?)");
+const QString QueryStrings::SelectAttachmentRefs =
+    QStringLiteral("SELECT r.STORAGE, a.CONTENT FROM MailAttachmentRefs r "
+                   "JOIN MailAttachments a ON a.HASH = r.HASH WHERE r.MESSAGEID=?");
+const QString QueryStrings::DeleteMailAttachmentRefs =
+    QStringLiteral("DELETE FROM MailAttachmentRefs WHERE MESSAGEID=?");
+const QString QueryStrings::DeleteOrphanAttachments =
+    QStringLiteral("DELETE FROM MailAttachments WHERE HASH NOT IN (SELECT HASH FROM MailAttachmentRefs)");
+const QString QueryStrings::BeginMailSavepoint    = QStringLiteral("SAVEPOINT ArchiveMail");
+const QString QueryStrings::ReleaseMailSavepoint  = QStringLiteral("RELEASE SAVEPOINT ArchiveMail");
+const QString QueryStrings::RollbackMailSavepoint = QStringLiteral("ROLLBACK TO SAVEPOINT ArchiveMail");
+const QString QueryStrings::CreateSettingsTable =
+    QStringLiteral("CREATE TABLE IF NOT EXISTS ArchiveSettings (NAME TEXT PRIMARY KEY NOT NULL, VALUE TEXT)");
+const QString QueryStrings::SelectSetting = QStringLiteral("SELECT VALUE FROM ArchiveSettings WHERE NAME=?");
+const QString QueryStrings::UpdateSetting =
+    QStringLiteral("INSERT OR REPLACE INTO ArchiveSettings (NAME, VALUE) VALUES (?,?)");
+const QString QueryStrings::DeleteSetting = QStringLiteral("DELETE FROM ArchiveSettings WHERE NAME=?");
+const QString QueryStrings::SelectCountOfAllMails =
+    QStringLiteral("SELECT COUNT(MESSAGEID) FROM MailArchive");
+const QString QueryStrings::SelectMessageIdsAfterRow =
+    QStringLiteral("SELECT ROWID, MESSAGEID FROM MailArchive WHERE ROWID > ? ORDER BY ROWID LIMIT ?");
+const QString QueryStrings::RekeyMail =
+    QStringLiteral("UPDATE MailArchive SET MESSAGEID=? WHERE MESSAGEID=?");
+const QString QueryStrings::RekeyFolderRels = QStringLiteral("UPDATE FolderRels SET MID=? WHERE MID=?");
+const QString QueryStrings::RekeyTagRels    = QStringLiteral("UPDATE TagRels SET MID=? WHERE MID=?");
+const QString QueryStrings::RekeyMailRecipients =
+    QStringLiteral("UPDATE MailRecipients SET MESSAGEID=? WHERE MESSAGEID=?");
+const QString QueryStrings::RekeyMailAttachmentRefs =
+    QStringLiteral("UPDATE MailAttachmentRefs SET MESSAGEID=? WHERE MESSAGEID=?");
+const QString QueryStrings::CreateContentKeysTable =
+    QStringLiteral("CREATE TABLE IF NOT EXISTS MailContentKeys ("
+                   "MESSAGEID VARCHAR(32) PRIMARY KEY NOT NULL, CONTENTHASH VARCHAR(32) NOT NULL)");
+const QString QueryStrings::CreateContentKeysHashIndex =
+    QStringLiteral("CREATE INDEX IF NOT EXISTS MailContentKeysHash ON MailContentKeys (CONTENTHASH)");
+const QString QueryStrings::SelectCountOfContentKeys =
+    QStringLiteral("SELECT COUNT(MESSAGEID) FROM MailContentKeys WHERE CONTENTHASH=?");
+const QString QueryStrings::InsertContentKey =
+    QStringLiteral("INSERT OR REPLACE INTO MailContentKeys (MESSAGEID, CONTENTHASH) VALUES (?,?)");
+const QString QueryStrings::DeleteMailContentKey =
+    QStringLiteral("DELETE FROM MailContentKeys WHERE MESSAGEID=?");
+const QString QueryStrings::RekeyMailContentKeys =
+    QStringLiteral("UPDATE MailContentKeys SET MESSAGEID=? WHERE MESSAGEID=?");
+const QString QueryStrings::SelectMessageIdsWithoutContentKey =
+    QStringLiteral("SELECT MESSAGEID FROM MailArchive WHERE MESSAGEID NOT IN "
+                   "(SELECT MESSAGEID FROM MailContentKeys)");
+const QString QueryStrings::SelectContentDuplicates =
+    QStringLiteral("SELECT COUNT(*), COUNT(DISTINCT CONTENTHASH), "
+                   "(SELECT COUNT(*) FROM (SELECT CONTENTHASH FROM MailContentKeys GROUP BY CONTENTHASH "
+                   "HAVING COUNT(*) > 1)) FROM MailContentKeys");
 const QString QueryStrings::SelectCountOfMails = QStringLiteral("SELECT COUNT(MESSAGEID) FROM "
                                                                 "MailArchive WHERE MESSAGEID=?");
 const QString QueryStrings::InsertNewMail = QStringLiteral("INSERT INTO MailArchive (MESSAGEID, FROM_NAME, "
@@ -95,3 +219,7 @@ const QString QueryStrings::SearchFromPattern =
 const QString QueryStrings::SearchToPattern =
     QStringLiteral("SELECT * FROM MailArchive WHERE TO_NAME like '%1' or TO_ADDR like '%1' or CC like '%1' "
                    "or BCC like '%1'");
+const QString QueryStrings::SearchToAddress =
+    QStringLiteral("SELECT * FROM MailArchive WHERE MESSAGEID IN (SELECT MESSAGEID FROM MailRecipients "
+                   "WHERE ADDRESS = ? COLLATE NOCASE) or (MESSAGEID NOT IN (SELECT MESSAGEID FROM "
+                   "MailRecipients) and (TO_NAME like ? or TO_ADDR like ? or CC like ? or BCC like ?))");
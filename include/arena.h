@@ -0,0 +1,69 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+#ifndef MAILARCHIVER_ARENA_H
+#define MAILARCHIVER_ARENA_H
+
+// std
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace Core
+{
+
+// Monotonic allocator for the decoded text of one message at a time. Memory is only given back as a
+// whole by reset(), which keeps a single block big enough for the previous message, so a worker
+// thread reusing one arena stops allocating once it has seen its largest message.
+class Arena
+{
+  private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+    std::vector<Block> m_Blocks;
+    std::size_t m_Used;      // bytes taken from the last block
+    std::size_t m_Reserved;  // bytes held by all blocks
+    std::size_t m_BlockSize; // minimum size of a new block
+    std::size_t m_Allocations;
+
+  public:
+    explicit Arena(std::size_t blockSize = 64 * 1024);
+
+    // Returns size bytes, valid until the next reset()
+    char* allocate(std::size_t size);
+    // Gives back the tail of the latest allocation, keeping its first used bytes
+    void shrink(char* last, std::size_t used);
+    std::string_view copy(std::string_view text);
+
+    void reset();
+
+    // Number of blocks taken from the heap so far
+    std::size_t allocations() const;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
+}
+
+#endif // MAILARCHIVER_ARENA_H
@@ -23,42 +23,141 @@
 #define MAILARCHIVER_MSG_H
 
 // std
+#include <cstdint>
+#include <list>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 // local
+#include "arena.h"
 #include "pole.h"
+#include "utils.h"
 
 namespace Core
 {
 
+// A PT_LONG, PT_BOOLEAN, PT_I8 or PT_SYSTIME value from the fixed size properties stream
+struct FixedProperty {
+    uint16_t id;
+    uint16_t type;
+    uint32_t flags;
+    uint64_t value; // zero extended for 32 bit types, raw FILETIME for PT_SYSTIME
+};
+
+// One __recip_version1.0_ sub-storage; name and address are UTF-8 views into the message's arena
+struct Recipient {
+    enum Type : int32_t { Originator = 0, To = 1, CC = 2, BCC = 3 };
+    int32_t type;
+    std::string_view name;
+    std::string_view address; // PR_SMTP_ADDRESS, else PR_EMAIL_ADDRESS
+};
+
+// One __attach_version1.0_ sub-storage with a PR_ATTACH_DATA_BIN stream
+struct Attachment {
+    std::string_view storage;  // storage name, e.g. "__attach_version1.0_#00000000"
+    std::string_view fileName; // PR_ATTACH_LONG_FILENAME, else PR_ATTACH_FILENAME
+    uint64_t size;             // bytes of attachment data, 0 for embedded messages
+    std::list<POLE::Extent> extents; // where the data lies in the .msg file
+};
+
+// The fields stored for one message, filled once. The views point into the Msg that made the record
+// and stay valid until that message is closed, reopened or destroyed.
+struct MsgRecord {
+    std::string_view hash;
+    std::string_view senderName, senderAddress;
+    std::string_view receiversNames, receiversAddresses;
+    std::string_view CCs, Bccs;
+    std::string_view subject;
+    std::string_view date;
+    std::string_view body;
+    std::string_view fileName;
+    const std::vector<Recipient>* recipients   = nullptr;
+    const std::vector<Attachment>* attachments = nullptr;
+    bool hasAttachments                        = false;
+
+    MsgRecord()                            = default;
+    MsgRecord(MsgRecord&&)                 = default;
+    MsgRecord& operator=(MsgRecord&&)      = default;
+    MsgRecord(const MsgRecord&)            = delete;
+    MsgRecord& operator=(const MsgRecord&) = delete;
+};
+
 class Msg
 {
+  public:
+    // Why a message could not be opened. Nothing is printed: callers decide what to report.
+    enum class Error { None, OpenFailed, NotCompoundFile, BadCompoundFile };
+
   private:
     POLE::Storage* m_File;
+    std::unique_ptr<std::string> m_Buffer;
+    Arena* m_Arena; // backs the decoded text below, reset on close
+    std::unique_ptr<Arena> m_OwnArena;
     bool m_Opened;
+    Error m_Error; // of the last open
+    unsigned m_Fields; // FieldMask of what open() decodes
     std::string m_FileName;
-    std::string m_SenderName, m_SenderAddress;
-    std::string m_ReceiversNames, m_ReceiversAddresses;
-    std::string m_Subject;
-    std::string m_CC;
-    std::string m_Bcc;
+    std::string_view m_SenderName, m_SenderAddress;
+    std::string_view m_ReceiversNames, m_ReceiversAddresses;
+    std::string_view m_Subject;
+    std::string_view m_CC;
+    std::string_view m_Bcc;
     std::string m_date;
-    std::string m_body;
+    std::string_view m_body;
     std::string m_hash;
+    std::string m_contentHash;
+    Utils::HashAlgorithm m_HashAlgorithm;
+    std::vector<FixedProperty> m_Properties;
+    std::vector<Recipient> m_Recipients;
+    std::vector<Attachment> m_Attachments;
+    int64_t m_SentTime;
+    bool m_hasSentTime;
     bool m_hasAttachments;
+    unsigned m_Codepage; // of the PT_STRING8 properties
+    unsigned m_BodyStreams; // BodyStream bits: which forms of the body the root scan found
 
   protected:
-    const std::string getDateTimeFromStream(const char* stream);
-    const std::string getStringFromStream(const char* stream);
-    void visit(int indent, POLE::Storage* storage, std::string path);
+    void readFixedProperties(POLE::ByteSpan bytes);
+    std::string_view getStringFromStream(const char* stream);
+    std::string_view getStringFromBytes(POLE::ByteSpan bytes);
+    std::string_view getString8FromBytes(POLE::ByteSpan bytes);
+    Arena& arena();
+    void visit(int indent, const std::string& path, std::string& listing);
+    void readProperties();
+    void hashStorage(const std::string& path, std::size_t headerSize, Utils::ContentHasher& hasher);
 
   public:
+    // What open() locates and decodes. Fields left out of the mask read as empty, or zero; hash(),
+    // contentHash() and rawBytes() need none of them.
+    enum FieldMask : unsigned {
+        NoFields         = 0,
+        SenderFields     = 1 << 0, // senderName(), senderAddress()
+        ReceiverFields   = 1 << 1, // receiversNames(), receiversAddresses()
+        CCField          = 1 << 2,
+        BccField         = 1 << 3,
+        SubjectField     = 1 << 4,
+        PropertiesFields = 1 << 5, // the properties stream: dates, size, importance, flags
+        RecipientsField  = 1 << 6,
+        AttachmentsField = 1 << 7, // attachments() and hasAttachments()
+        BodyField        = 1 << 8, // read on demand by body()
+        AllFields        = (1 << 9) - 1
+    };
+
     Msg();
-    explicit Msg(const std::string& filename);
+    explicit Msg(const std::string& filename, unsigned fields = AllFields);
+    // The text of the message lives in arena, which is reset when the message is closed or reopened:
+    // an arena can serve one open message at a time, e.g. one per worker thread.
+    explicit Msg(Arena& arena);
+    Msg(const std::string& filename, Arena& arena, unsigned fields = AllFields);
 
     ~Msg();
 
-    bool open(const char* arg1);
+    Error open(const char* arg1, unsigned fields = AllFields);
+    Error openBuffer(std::string contents, unsigned fields = AllFields);
+    Error error(); // what the last open returned, e.g. the one run by a constructor
+    unsigned fields();
 
     void loadBody();
 
@@ -71,11 +170,33 @@ class Msg
     const std::string Bccs();
     const std::string subject();
     const std::string date();
-    const std::string& body();
+    const std::string dateTime();
+    int64_t sentTime();     // seconds since the Unix epoch, UTC
+    int64_t receivedTime(); // seconds since the Unix epoch, UTC, 0 when unknown
+    int32_t messageSize();
+    int32_t importance();
+    int32_t messageFlags();
+    const std::vector<Recipient>& recipients();
+    const std::vector<Attachment>& attachments();
+    std::string attachmentData(const Attachment& attachment);
+    POLE::ByteSpan rawBytes(); // the whole .msg file
+    uint64_t bytesRead();      // bytes loaded from disk to open it, each read exactly once
+    static bool restoreAttachment(std::string& msgBytes, const std::string& storage, const std::string& data);
+    const std::vector<FixedProperty>& fixedProperties();
+    const FixedProperty* fixedProperty(uint16_t id);
+    const std::string body();
     const std::string hash();
+    // Hash of the message content rather than of the file: equal for two saves of the same email,
+    // whatever their sector layout and save timestamps
+    const std::string contentHash();
+    // The algorithm hash() uses, MD5 unless set otherwise. Kept when the message is reopened.
+    void setHashAlgorithm(Utils::HashAlgorithm algorithm);
+    Utils::HashAlgorithm hashAlgorithm();
 
     bool hasAttachments();
 
+    MsgRecord record();
+
     void close();
 
     // No copy operators
@@ -85,6 +206,9 @@ class Msg
     // Move-only
     Msg(Msg&& rhs);
     Msg& operator=(Msg&& rhs);
+
+  private:
+    Error finishOpen();
 };
 }
 
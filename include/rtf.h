@@ -0,0 +1,47 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+#ifndef MAILARCHIVER_RTF_H
+#define MAILARCHIVER_RTF_H
+
+#include <cstddef>
+#include <string>
+
+namespace Utils
+{
+// Decompresses a PR_RTF_COMPRESSED stream (LZFu, or the uncompressed MELA form) and appends the RTF to
+// rtf. Returns false on a malformed header or truncated data.
+bool lzfu_decompress(const unsigned char* data, std::size_t len, std::string& rtf);
+
+// Appends the plain text of RTF to text, as UTF-8. HTML encapsulated in RTF (\fromhtml1) is reduced to
+// its text as html_to_text() does; encapsulated plain text (\fromtext) comes out as it was.
+void rtf_to_text(const char* rtf, std::size_t len, std::string& text);
+
+// lzfu_decompress() and rtf_to_text() in one pass: the decompressed RTF is parsed as it is produced and
+// never stored.
+bool compressed_rtf_to_text(const unsigned char* data, std::size_t len, std::string& text);
+
+// Appends the text of an HTML document to text: tags, comments, styles and scripts are dropped,
+// entities decoded, white space collapsed and block elements put on lines of their own.
+void html_to_text(const char* html, std::size_t len, std::string& text);
+}
+
+#endif // MAILARCHIVER_RTF_H
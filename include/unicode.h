@@ -0,0 +1,51 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+#ifndef MAILARCHIVER_UNICODE_H
+#define MAILARCHIVER_UNICODE_H
+
+#include <cstddef>
+#include <string>
+
+namespace Utils
+{
+// Appends the UTF-8 form of len bytes of UTF-16LE text to out. A trailing odd byte is ignored.
+// Unpaired surrogates are written as U+FFFD and make the call return false.
+bool utf16le_to_utf8(const unsigned char* data, std::size_t len, std::string& out);
+
+// Same conversion into a caller buffer of at least 3 bytes per code unit; returns the bytes written.
+std::size_t utf16le_to_utf8(const unsigned char* data, std::size_t len, char* out, bool* valid = nullptr);
+
+// Code page 8-bit text is read in when none is given
+const unsigned DefaultCodepage = 1252;
+
+// True for the single byte code pages that have a decoding table, and for 65001 (UTF-8)
+bool codepage_supported(unsigned codepage);
+
+// Converts len bytes of 8-bit text in codepage into a caller buffer of at least 3 bytes per byte and
+// returns the bytes written. Unsupported code pages, the double byte ones among them, read as Windows-1252.
+std::size_t codepage_to_utf8(unsigned codepage, const unsigned char* data, std::size_t len, char* out);
+
+// The code point of a single byte in codepage, under the same fallback
+char32_t codepage_code_point(unsigned codepage, unsigned char c);
+}
+
+#endif // MAILARCHIVER_UNICODE_H
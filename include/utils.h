@@ -22,14 +22,46 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
+#include <memory>
 #include <string>
 
 namespace Utils
 {
+// Content hashes usable as message keys. All of them are 128 bits wide, i.e. 32 hex digits.
+enum class HashAlgorithm { MD5, XXH3_128 };
+
 std::string base64_encode(const std::string& val);
 std::string base64_decode(const std::string& val);
 std::string string_compress_encode_file(const std::string& filename);
+std::string string_compress_encode(const std::string& data);
+std::string string_compress_encode(const char* data, std::size_t size);
+std::string string_decompress_decode(const std::string& data);
 void string_decompress_decode_to_file(const std::string& data, const std::string& filename);
+std::string md5_hex(const unsigned char* data, std::size_t len);
+std::string xxh3_128_hex(const unsigned char* data, std::size_t len);
+std::string content_hash_hex(HashAlgorithm algorithm, const unsigned char* data, std::size_t len);
+const char* hash_algorithm_name(HashAlgorithm algorithm);
+bool hash_algorithm_from_name(const std::string& name, HashAlgorithm& algorithm);
+
+// Incremental form of content_hash_hex, for data fed in pieces. hexDigest() ends the hash.
+class ContentHasher
+{
+  public:
+    explicit ContentHasher(HashAlgorithm algorithm);
+    ~ContentHasher();
+
+    void update(const unsigned char* data, std::size_t len);
+    std::string hexDigest();
+
+    ContentHasher(const ContentHasher&) = delete;
+    ContentHasher& operator=(const ContentHasher&) = delete;
+
+  private:
+    struct State;
+    HashAlgorithm m_Algorithm;
+    std::unique_ptr<State> m_State;
+};
 };
 
 #endif // UTILS_H
@@ -20,12 +20,14 @@
 **************************************************************************/
 
 // std
+#include <cstring>
 #include <fstream>
 #include <sstream>
 // Qt
 #include <QString>
 #include <QUrl>
 #include <QDirIterator>
+#include <QStringList>
 #include <QSqlQuery>
 #include <QFile>
 #include <QBuffer>
@@ -39,7 +41,37 @@
 #include "MailArchive.h"
 #include "QueryStrings.h"
 
-MailArchive::MailArchive(const QString& filename) : transactionCounter{0}
+namespace
+{
+// Attachments under the 4096 byte mini stream cutoff of compound files stay inside the message blob:
+// their data is scattered over 64 byte mini sectors, and sharing them would cost a row, a lookup and
+// a compressed blob each for little saved space
+const uint64_t MinSharedAttachmentSize = 4096;
+
+// Keys of new archives, and of legacy ones once migrated. Content keys always use it.
+const Utils::HashAlgorithm DefaultHashAlgorithm = Utils::HashAlgorithm::XXH3_128;
+
+// ArchiveSettings entries
+const QString HashAlgorithmSetting     = QStringLiteral("HashAlgorithm");
+const QString HashMigrationToSetting   = QStringLiteral("HashMigrationTo");
+const QString HashMigrationRowSetting  = QStringLiteral("HashMigrationRow");
+const QString HashMigrationSkipSetting = QStringLiteral("HashMigrationSkipped");
+const QString DedupeKeySetting         = QStringLiteral("DedupeKey");
+const QString RecipientsRowSetting     = QStringLiteral("RecipientsBackfillRow");
+const QString RecipientsEndSetting     = QStringLiteral("RecipientsBackfillEnd");
+const QString ContentDedupeKey         = QStringLiteral("Content");
+const QString FileDedupeKey            = QStringLiteral("File");
+
+QString toQString(std::string_view text)
+{
+    return QString::fromUtf8(text.data(), static_cast<int>(text.size()));
+}
+}
+
+MailArchive::MailArchive(const QString& filename)
+    : transactionCounter{0}, m_BytesRead{0}, m_HashAlgorithm{Utils::HashAlgorithm::MD5},
+      m_MigrationAlgorithm{DefaultHashAlgorithm}, m_MigratingHashes{false}, m_RekeyPending{false},
+      m_BackfillingRecipients{false}, m_ContentDedupe{false}
 {
     openFile(filename);
     m_Folders = std::make_unique<QSqlQueryModel>();
@@ -68,14 +100,393 @@ void MailArchive::openFile(const QString& filename)
         q.exec(QueryStrings::CreateTagsTable);
         q.exec(QueryStrings::CreateFolderRelsTable);
         q.exec(QueryStrings::CreateTagRelsTable);
+
+        q.exec(QueryStrings::CreateSettingsTable);
+
+        // Messages archived before the recipients table get their rows from backfillRecipients(), up
+        // to the last message there is now
+        q.exec(QueryStrings::SelectRecipientsTable);
+        bool hadRecipients = q.next();
+        q.exec(QueryStrings::CreateRecipientsTable);
+        q.exec(QueryStrings::CreateRecipientsAddressIndex);
+        q.exec(QueryStrings::CreateRecipientsMessageIndex);
+        if (!hadRecipients) {
+            q.exec(QueryStrings::SelectLastMailRow);
+            if (q.next() && q.value(0).toLongLong() > 0) {
+                setSetting(RecipientsRowSetting, QStringLiteral("0"));
+                setSetting(RecipientsEndSetting, q.value(0).toString());
+            }
+        }
+        m_BackfillingRecipients = !setting(RecipientsEndSetting).isEmpty();
+
+        q.exec(QueryStrings::CreateAttachmentsTable);
+        q.exec(QueryStrings::CreateAttachmentRefsTable);
+        q.exec(QueryStrings::CreateAttachmentRefsMessageIndex);
+        q.exec(QueryStrings::CreateAttachmentRefsHashIndex);
+
+        q.exec(QueryStrings::CreateContentKeysTable);
+        q.exec(QueryStrings::CreateContentKeysHashIndex);
+
+        loadHashAlgorithm();
+        m_ContentDedupe = setting(DedupeKeySetting) == ContentDedupeKey;
+    }
+}
+
+QString MailArchive::setting(const QString& name)
+{
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::SelectSetting);
+    q.addBindValue(name);
+    q.exec();
+    return q.next() ? q.value(0).toString() : QString();
+}
+
+void MailArchive::setSetting(const QString& name, const QString& value)
+{
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::UpdateSetting);
+    q.addBindValue(name);
+    q.addBindValue(value);
+    if (!q.exec())
+        qDebug() << q.lastError();
+}
+
+// Archives written before the key algorithm was recorded are keyed by the MD5 of whatever the old
+// parser hashed, which cannot be computed again from the file. They keep MD5 for new messages while
+// migrateHashes() rekeys their stored blobs to the default algorithm in the background.
+void MailArchive::loadHashAlgorithm()
+{
+    QString name = setting(HashAlgorithmSetting);
+    if (name.isEmpty()) {
+        QSqlQuery q(db);
+        q.exec(QueryStrings::SelectCountOfAllMails);
+        if (q.next() && q.value(0).toLongLong() > 0) {
+            name = Utils::hash_algorithm_name(Utils::HashAlgorithm::MD5);
+            setSetting(HashMigrationToSetting, Utils::hash_algorithm_name(DefaultHashAlgorithm));
+            setSetting(HashMigrationRowSetting, QStringLiteral("0"));
+        } else {
+            name = Utils::hash_algorithm_name(DefaultHashAlgorithm);
+        }
+        setSetting(HashAlgorithmSetting, name);
+    }
+    if (!Utils::hash_algorithm_from_name(name.toStdString(), m_HashAlgorithm)) {
+        qDebug() << "Unknown message key algorithm" << name << "falling back to MD5";
+        m_HashAlgorithm = Utils::HashAlgorithm::MD5;
+    }
+    std::string target = setting(HashMigrationToSetting).toStdString();
+    m_MigratingHashes  = Utils::hash_algorithm_from_name(target, m_MigrationAlgorithm);
+    m_RekeyPending     = m_MigratingHashes;
+}
+
+// While a migration runs, a message may be stored under its key in either algorithm
+bool MailArchive::containsMsg(const QString& messageId, const QString& migratedId, const QString& contentKey)
+{
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::SelectCountOfMails);
+    for (const QString& id : {messageId, migratedId}) {
+        if (id.isEmpty())
+            continue;
+        q.bindValue(0, id);
+        q.exec();
+        if (q.next() && q.value(0).toInt() > 0)
+            return true;
+    }
+
+    if (!contentKey.isEmpty()) {
+        q.prepare(QueryStrings::SelectCountOfContentKeys);
+        q.addBindValue(contentKey);
+        q.exec();
+        if (q.next() && q.value(0).toInt() > 0)
+            return true;
+    }
+
+    return false;
+}
+
+void MailArchive::insertContentKey(const QString& messageId, const QString& contentKey)
+{
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::InsertContentKey);
+    q.addBindValue(messageId);
+    q.addBindValue(contentKey);
+    if (!q.exec())
+        qDebug() << q.lastError();
+}
+
+void MailArchive::setContentDedupe(bool enabled)
+{
+    setSetting(DedupeKeySetting, enabled ? ContentDedupeKey : FileDedupeKey);
+    m_ContentDedupe = enabled;
+    // Messages archived so far need their content keys before new ones are checked against them
+    if (enabled)
+        contentDuplicateReport();
+}
+
+MailArchive::DuplicateReport MailArchive::contentDuplicateReport()
+{
+    QSqlQuery q(db);
+    q.exec(QueryStrings::SelectMessageIdsWithoutContentKey);
+    QStringList missing;
+    while (q.next())
+        missing << q.value(0).toString();
+
+    db.transaction();
+    Core::Arena arena;
+    Core::Msg msg(arena);
+    msg.setHashAlgorithm(DefaultHashAlgorithm);
+    for (const QString& messageId : missing) {
+        if (msg.openBuffer(restoreMsgBytes(messageId), Core::Msg::NoFields) == Core::Msg::Error::None)
+            insertContentKey(messageId, QString::fromStdString(msg.contentHash()));
+    }
+    db.commit();
+
+    DuplicateReport report{0, 0, 0};
+    q.exec(QueryStrings::SelectContentDuplicates);
+    if (q.next()) {
+        report.messages   = q.value(0).toLongLong();
+        report.duplicates = report.messages - q.value(1).toLongLong();
+        report.groups     = q.value(2).toLongLong();
+    }
+    qDebug() << "Content duplicates:" << report.duplicates << "of" << report.messages << "messages, in"
+             << report.groups << "groups";
+    return report;
+}
+
+void MailArchive::rekeyMsg(const QString& oldId, const QString& newId)
+{
+    QSqlQuery q(db);
+    for (const QString& statement :
+         {QueryStrings::RekeyMail, QueryStrings::RekeyFolderRels, QueryStrings::RekeyTagRels,
+          QueryStrings::RekeyMailRecipients, QueryStrings::RekeyMailAttachmentRefs,
+          QueryStrings::RekeyMailContentKeys}) {
+        q.prepare(statement);
+        q.addBindValue(newId);
+        q.addBindValue(oldId);
+        if (!q.exec())
+            qDebug() << q.lastError();
+    }
+}
+
+// A row is only counted as migrated once it carries its new key. One whose blob cannot be read is
+// skipped, and keeps the archive on its legacy algorithm: the pass starts over on the next open.
+bool MailArchive::migrateHashes(int batchSize)
+{
+    if (!m_RekeyPending)
+        return false;
+
+    QSqlQuery rows(db);
+    rows.prepare(QueryStrings::SelectMessageIdsAfterRow);
+    rows.addBindValue(setting(HashMigrationRowSetting).toLongLong());
+    rows.addBindValue(batchSize);
+    rows.exec();
+
+    std::vector<std::pair<qlonglong, QString>> batch;
+    while (rows.next())
+        batch.emplace_back(rows.value(0).toLongLong(), rows.value(1).toString());
+
+    db.transaction();
+    QSqlQuery q(db);
+    int skipped = setting(HashMigrationSkipSetting).toInt();
+    for (const auto& row : batch) {
+        // Hash the original bytes, as archiveMsg would have
+        std::string bytes = restoreMsgBytes(row.second);
+        QString newId     = QString::fromStdString(Utils::content_hash_hex(
+            m_MigrationAlgorithm, reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size()));
+        if (bytes.empty()) {
+            qDebug() << "Cannot rekey" << row.second << ": its contents cannot be read";
+            ++skipped;
+        } else if (newId != row.second) {
+            q.prepare(QueryStrings::SelectCountOfMails);
+            q.addBindValue(newId);
+            q.exec();
+            if (q.next() && q.value(0).toInt() > 0) {
+                // The same file was archived again under its new key: keep that one, with the
+                // folders and tags of both
+                q.prepare(QueryStrings::RekeyFolderRels);
+                q.addBindValue(newId);
+                q.addBindValue(row.second);
+                q.exec();
+                q.prepare(QueryStrings::RekeyTagRels);
+                q.addBindValue(newId);
+                q.addBindValue(row.second);
+                q.exec();
+                deleteMsgRows(row.second);
+            } else {
+                rekeyMsg(row.second, newId);
+            }
+        }
+        setSetting(HashMigrationRowSetting, QString::number(row.first));
+    }
+    setSetting(HashMigrationSkipSetting, QString::number(skipped));
+
+    if (batch.size() < static_cast<std::size_t>(batchSize)) {
+        m_RekeyPending = false;
+        if (skipped == 0) {
+            setSetting(HashAlgorithmSetting, Utils::hash_algorithm_name(m_MigrationAlgorithm));
+            for (const QString& name :
+                 {HashMigrationToSetting, HashMigrationRowSetting, HashMigrationSkipSetting}) {
+                q.prepare(QueryStrings::DeleteSetting);
+                q.addBindValue(name);
+                q.exec();
+            }
+            m_HashAlgorithm   = m_MigrationAlgorithm;
+            m_MigratingHashes = false;
+        } else {
+            qDebug() << skipped << "messages could not be rekeyed, keeping the legacy keys";
+            setSetting(HashMigrationRowSetting, QStringLiteral("0"));
+            setSetting(HashMigrationSkipSetting, QStringLiteral("0"));
+        }
+    }
+    db.commit();
+
+    if (!m_RekeyPending)
+        refreshQueries();
+    return m_RekeyPending;
+}
+
+void MailArchive::insertRecipients(const QString& messageId, const std::vector<Core::Recipient>& recipients)
+{
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::InsertRecipient);
+    for (const Core::Recipient& recipient : recipients) {
+        q.addBindValue(messageId);
+        q.addBindValue(recipient.type);
+        q.addBindValue(toQString(recipient.name));
+        q.addBindValue(toQString(recipient.address));
+        if (!q.exec())
+            qDebug() << q.lastError();
+    }
+}
+
+// Stores each attachment once by content hash, referenced from the message, and returns the
+// message bytes with those attachments' sectors zeroed, ready to be compressed. Returns an empty
+// string when no attachment was shared, so the mapped message can be compressed without a copy.
+std::string MailArchive::storeAttachments(const QString& messageId, Core::Msg& msgFile,
+                                          const Core::MsgRecord& rec)
+{
+    POLE::ByteSpan raw = msgFile.rawBytes();
+    std::string stored;
+
+    QSqlQuery q(db);
+    for (const Core::Attachment& attachment : *rec.attachments) {
+        if (attachment.size < MinSharedAttachmentSize)
+            continue;
+        std::string data = msgFile.attachmentData(attachment);
+        if (data.size() != attachment.size)
+            continue;
+        QString hash = QString::fromStdString(Utils::content_hash_hex(
+            m_HashAlgorithm, reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+
+        q.prepare(QueryStrings::SelectCountOfAttachments);
+        q.addBindValue(hash);
+        q.exec();
+        q.next();
+        if (q.value(0).toInt() == 0) {
+            std::string compressed = Utils::string_compress_encode(data);
+            q.prepare(QueryStrings::InsertAttachment);
+            q.addBindValue(hash);
+            q.addBindValue(static_cast<qulonglong>(data.size()));
+            q.addBindValue(QByteArray(compressed.data(), static_cast<int>(compressed.size())),
+                           QSql::In | QSql::Binary);
+            if (!q.exec()) {
+                qDebug() << q.lastError();
+                continue;
+            }
+        }
+
+        q.prepare(QueryStrings::InsertAttachmentRef);
+        q.addBindValue(messageId);
+        q.addBindValue(toQString(attachment.storage));
+        q.addBindValue(hash);
+        q.addBindValue(toQString(attachment.fileName));
+        if (!q.exec()) {
+            qDebug() << q.lastError();
+            continue;
+        }
+
+        if (stored.empty())
+            stored.assign(reinterpret_cast<const char*>(raw.data), raw.size);
+        for (const POLE::Extent& extent : attachment.extents)
+            std::memset(&stored[extent.offset], 0, extent.length);
+    }
+    return stored;
+}
+
+// The original .msg bytes: the message blob with its shared attachments written back
+std::string MailArchive::restoreMsgBytes(const QString& messageId)
+{
+    std::string bytes;
+    QSqlQuery q(db);
+    q.prepare(QueryStrings::SelectCompressedContents);
+    q.addBindValue(messageId);
+    q.exec();
+    if (!q.next())
+        return bytes;
+    QByteArray array(q.value(0).toByteArray());
+    bytes = Utils::string_decompress_decode(std::string(array.data(), array.size()));
+
+    q.prepare(QueryStrings::SelectAttachmentRefs);
+    q.addBindValue(messageId);
+    q.exec();
+    while (q.next()) {
+        QByteArray content(q.value(1).toByteArray());
+        std::string data = Utils::string_decompress_decode(std::string(content.data(), content.size()));
+        if (!Core::Msg::restoreAttachment(bytes, q.value(0).toString().toStdString(), data))
+            qDebug() << "Could not restore attachment" << q.value(0).toString() << "of" << messageId;
+    }
+    return bytes;
+}
+
+bool MailArchive::backfillRecipients(int batchSize)
+{
+    if (!m_BackfillingRecipients)
+        return false;
+
+    QSqlQuery rows(db);
+    rows.prepare(QueryStrings::SelectMessageIdsInRows);
+    rows.addBindValue(setting(RecipientsRowSetting).toLongLong());
+    rows.addBindValue(setting(RecipientsEndSetting).toLongLong());
+    rows.addBindValue(batchSize);
+    rows.exec();
+
+    std::vector<std::pair<qlonglong, QString>> batch;
+    while (rows.next())
+        batch.emplace_back(rows.value(0).toLongLong(), rows.value(1).toString());
+
+    db.transaction();
+    Core::Arena arena;
+    Core::Msg msg(arena);
+    for (const auto& row : batch) {
+        // Only the recipient sub-storages are parsed
+        if (msg.openBuffer(restoreMsgBytes(row.second), Core::Msg::RecipientsField) == Core::Msg::Error::None)
+            insertRecipients(row.second, msg.recipients());
+        setSetting(RecipientsRowSetting, QString::number(row.first));
+    }
+    if (batch.size() < static_cast<std::size_t>(batchSize)) {
+        QSqlQuery q(db);
+        for (const QString& name : {RecipientsRowSetting, RecipientsEndSetting}) {
+            q.prepare(QueryStrings::DeleteSetting);
+            q.addBindValue(name);
+            q.exec();
+        }
+        m_BackfillingRecipients = false;
     }
+    db.commit();
+    return m_BackfillingRecipients;
 }
 
 void MailArchive::refreshQueries()
 {
-    QString query = m_Emails->query().lastQuery();
+    // A prepared search runs again with the values bound to it
+    QSqlQuery emails = m_Emails->query();
+    QString query    = emails.lastQuery();
     m_Emails->setQuery("", db);
-    m_Emails->setQuery(query, db);
+    if (emails.boundValues().isEmpty()) {
+        m_Emails->setQuery(query, db);
+    } else {
+        emails.exec();
+        m_Emails->setQuery(emails);
+    }
     query = m_Folders->query().lastQuery();
     m_Folders->setQuery("", db);
     m_Folders->setQuery(query, db);
@@ -112,7 +523,19 @@ void MailArchive::setSearchFilter(const QString& like, SearchPattern pattern)
         break;
 
     case SearchPattern::To:
-        m_Emails->setQuery(QueryStrings::SearchToPattern.arg(like), db);
+        // A plain address is looked up through the recipients index, patterns still scan. The lookup
+        // compares with '=', so a '_' in the address matches itself rather than any character. Mails
+        // without recipient sub-storages have no rows there and are matched on their address columns.
+        if (like.contains('@') && !like.contains('%') && !m_BackfillingRecipients) {
+            QSqlQuery q(db);
+            q.prepare(QueryStrings::SearchToAddress);
+            for (int column = 0; column < 5; ++column)
+                q.addBindValue(like);
+            q.exec();
+            m_Emails->setQuery(q);
+        } else {
+            m_Emails->setQuery(QueryStrings::SearchToPattern.arg(like), db);
+        }
         break;
 
     default:
@@ -124,50 +547,76 @@ void MailArchive::setSearchFilter(const QString& like, SearchPattern pattern)
 void MailArchive::archiveFolder(const QString& folder)
 {
     QDirIterator it(folder, QStringList() << "*.msg", QDir::Files);
+    Core::Arena arena;
     while (it.hasNext()) {
         QString mes = it.next();
         qDebug() << mes;
-        Core::Msg msg(mes.toStdString());
+        Core::Msg msg(mes.toStdString(), arena);
+        Core::Msg::Error error = msg.error();
+        if (error != Core::Msg::Error::None) {
+            qDebug() << "Skipping" << mes << "which cannot be read as a .msg file, error"
+                     << static_cast<int>(error);
+            continue;
+        }
+        m_BytesRead += msg.bytesRead();
+        qDebug() << "bytes read" << msg.bytesRead();
         archiveMsg(msg);
         db.commit();
     }
+    qDebug() << "bytes read in total" << m_BytesRead;
     refreshQueries();
 }
 
 void MailArchive::archiveMsg(Core::Msg& msgFile)
 {
+    // Content keys, and the keys rows are migrated to, are in the default algorithm
+    msgFile.setHashAlgorithm(DefaultHashAlgorithm);
+    const QString migratedId = m_MigratingHashes ? QString::fromStdString(msgFile.hash()) : QString();
+    const QString contentKey = m_ContentDedupe ? QString::fromStdString(msgFile.contentHash()) : QString();
+
+    msgFile.setHashAlgorithm(m_HashAlgorithm);
+    const Core::MsgRecord rec = msgFile.record();
+    const QString messageId   = toQString(rec.hash);
+
     QSqlQuery q(db);
-    q.prepare(QueryStrings::SelectCountOfMails);
-    q.addBindValue(msgFile.hash().c_str());
-    q.exec();
-    q.next();
-    if (q.value(0).toInt() == 0) {
+    if (!containsMsg(messageId, migratedId, contentKey)) {
         if (transactionCounter == 0)
             db.transaction();
+        // The attachments, recipients and content key of a mail are only kept along with the mail
+        QSqlQuery savepoint(db);
+        savepoint.exec(QueryStrings::BeginMailSavepoint);
 
         q.prepare(QueryStrings::InsertNewMail);
-        q.addBindValue(msgFile.hash().c_str());
-        q.addBindValue(msgFile.senderName().c_str());
-        q.addBindValue(msgFile.senderAddress().c_str());
-        q.addBindValue(msgFile.receiversNames().c_str());
-        q.addBindValue(msgFile.receiversAddresses().c_str());
-        q.addBindValue(msgFile.CCs().c_str());
-        q.addBindValue(msgFile.Bccs().c_str());
-        q.addBindValue(msgFile.subject().c_str());
-        q.addBindValue(msgFile.date().c_str());
-        q.addBindValue(msgFile.body().c_str());
-        std::string compressed = Utils::string_compress_encode_file(msgFile.fileName());
+        q.addBindValue(messageId);
+        q.addBindValue(toQString(rec.senderName));
+        q.addBindValue(toQString(rec.senderAddress));
+        q.addBindValue(toQString(rec.receiversNames));
+        q.addBindValue(toQString(rec.receiversAddresses));
+        q.addBindValue(toQString(rec.CCs));
+        q.addBindValue(toQString(rec.Bccs));
+        q.addBindValue(toQString(rec.subject));
+        q.addBindValue(toQString(rec.date));
+        q.addBindValue(toQString(rec.body));
+        std::string stored = storeAttachments(messageId, msgFile, rec);
+        POLE::ByteSpan raw = msgFile.rawBytes();
+        std::string compressed =
+            stored.empty() ? Utils::string_compress_encode(reinterpret_cast<const char*>(raw.data), raw.size)
+                           : Utils::string_compress_encode(stored);
         qDebug() << compressed.size();
-        q.addBindValue(compressed.data(), QSql::In | QSql::Binary);
-        q.addBindValue(msgFile.hasAttachments());
+        q.addBindValue(QByteArray(compressed.data(), static_cast<int>(compressed.size())),
+                       QSql::In | QSql::Binary);
+        q.addBindValue(rec.hasAttachments);
 
-        if (q.exec())
+        if (q.exec()) {
+            insertRecipients(messageId, *rec.recipients);
+            if (m_ContentDedupe)
+                insertContentKey(messageId, contentKey);
             ++transactionCounter;
-        else {
+        } else {
             qDebug() << q.lastError();
-            db.close();
-            db.open();
+            savepoint.exec(QueryStrings::RollbackMailSavepoint);
         }
+        savepoint.exec(QueryStrings::ReleaseMailSavepoint);
 
         qDebug() << q.lastQuery();
 
@@ -182,36 +631,49 @@ void MailArchive::archiveMsg(Core::Msg& msgFile)
     } else {
         qDebug() << "This email already exists into the "
                     "archive: "
-                 << msgFile.hash().c_str();
+                 << messageId;
     }
 }
 
 Core::Msg MailArchive::retrieveMsg(const QString& messageId)
 {
-    saveMsgAsFile(messageId, messageId);
-    Core::Msg msg(messageId.toStdString());
+    Core::Msg msg;
+    std::string bytes = restoreMsgBytes(messageId);
+    if (!bytes.empty())
+        msg.openBuffer(std::move(bytes));
     return msg;
 }
 
 void MailArchive::saveMsgAsFile(const QString& messageId, const QString& fileName)
 {
-    QSqlQuery q(db);
-    q.prepare(QueryStrings::SelectCompressedContents);
-    q.addBindValue(messageId);
-    q.exec();
-    if (q.next()) {
-        QByteArray array(q.value(0).toByteArray());
-        std::string input(array.data(), array.size());
-        Utils::string_decompress_decode_to_file(input, fileName.toStdString());
+    std::string bytes = restoreMsgBytes(messageId);
+    if (!bytes.empty()) {
+        std::ofstream file(fileName.toStdString().c_str(), std::ios::binary);
+        file.write(bytes.data(), bytes.size());
     }
 }
 
 void MailArchive::deleteMsg(const QString& id)
+{
+    deleteMsgRows(id);
+    // TODO: Delete from folders too.
+    refreshQueries();
+}
+
+void MailArchive::deleteMsgRows(const QString& id)
 {
     QSqlQuery q(db);
     q.prepare(QueryStrings::DeleteMail);
     q.addBindValue(id);
     q.exec();
-    // TODO: Delete from folders too.
-    refreshQueries();
+    q.prepare(QueryStrings::DeleteMailRecipients);
+    q.addBindValue(id);
+    q.exec();
+    q.prepare(QueryStrings::DeleteMailAttachmentRefs);
+    q.addBindValue(id);
+    q.exec();
+    q.prepare(QueryStrings::DeleteMailContentKey);
+    q.addBindValue(id);
+    q.exec();
+    q.exec(QueryStrings::DeleteOrphanAttachments);
 }
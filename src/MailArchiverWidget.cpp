@@ -24,6 +24,7 @@
 // Qt
 #include <QKeyEvent>
 #include <QCloseEvent>
+#include <QTimer>
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QFileDialog>
@@ -45,7 +46,8 @@
 
 MailArchiverWidget::MailArchiverWidget()
     : ctxMenu(new QMenu(this)), ui(new Ui::MailArchiverWidget), delegate(new MailListDelegate()),
-      archiveMgr(&ArchiveManager::instance())
+      archiveMgr(&ArchiveManager::instance()), hashBackfill(new QTimer(this)),
+      recipientBackfill(new QTimer(this))
 {
     ui->setupUi(this);
     ui->mailListView->setItemDelegate(delegate);
@@ -71,6 +73,7 @@ void MailArchiverWidget::createConnections()
     connect(ui->actionArchiveEmails, &QAction::triggered, this, &MailArchiverWidget::onArchiveEmails);
     connect(ui->actionArchiveEntireFolder, &QAction::triggered, this,
             &MailArchiverWidget::onArchiveEntireFolder);
+    connect(ui->actionFindDuplicates, &QAction::triggered, this, &MailArchiverWidget::onFindDuplicates);
 
     connect(ui->mailListView, &QListView::customContextMenuRequested, this,
             &MailArchiverWidget::onCustomCtxMenuRequested);
@@ -87,6 +90,8 @@ void MailArchiverWidget::createConnections()
     connect(ui->searchEdit, &QLineEdit::textChanged, this, &MailArchiverWidget::onSearchLineChanged);
     connect(ui->searchButton, &QPushButton::clicked, this, &MailArchiverWidget::onSearchButtonClicked);
     connect(ui->buttonGroup, SIGNAL(buttonPressed(int)), this, SLOT(onButtonGroupPressed(int)));
+    connect(hashBackfill, &QTimer::timeout, this, &MailArchiverWidget::onHashBackfill);
+    connect(recipientBackfill, &QTimer::timeout, this, &MailArchiverWidget::onRecipientBackfill);
 }
 
 MailArchiverWidget::~MailArchiverWidget()
@@ -143,6 +148,10 @@ void MailArchiverWidget::onOpenArchive()
             QApplication::restoreOverrideCursor();
         });
         f.get();
+        if (archiveMgr->current().hashMigrationPending())
+            hashBackfill->start(0);
+        if (archiveMgr->current().recipientBackfillPending())
+            recipientBackfill->start(0);
     }
 }
 
@@ -160,6 +169,10 @@ void MailArchiverWidget::onNewArchive()
             QApplication::restoreOverrideCursor();
         });
         f.get();
+        if (archiveMgr->current().hashMigrationPending())
+            hashBackfill->start(0);
+        if (archiveMgr->current().recipientBackfillPending())
+            recipientBackfill->start(0);
     }
 }
 
@@ -190,6 +203,29 @@ void MailArchiverWidget::onArchiveEntireFolder()
     f.get();
 }
 
+void MailArchiverWidget::onFindDuplicates()
+{
+    if (archiveMgr->currentName().isEmpty())
+        return;
+    MailArchive& archive = archiveMgr->current();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    MailArchive::DuplicateReport report = archive.contentDuplicateReport();
+    QApplication::restoreOverrideCursor();
+
+    QString text = tr("%1 of %2 archived messages have the same content as another one (%3 groups).")
+                       .arg(report.duplicates)
+                       .arg(report.messages)
+                       .arg(report.groups);
+    if (archive.contentDedupe()) {
+        QMessageBox::information(this, tr("Duplicates"), text);
+        return;
+    }
+    int res = QMessageBox::question(this, tr("Duplicates"),
+                                    text + "\n\n" + tr("Skip emails whose content is already archived?"));
+    if (res == QMessageBox::Yes)
+        archive.setContentDedupe(true);
+}
+
 void MailArchiverWidget::onSelectedOpenedArchive(const QModelIndex& index)
 {
     if (index.isValid()) {
@@ -307,3 +343,24 @@ void MailArchiverWidget::onActionRemoveFromArchive()
         archiveMgr->current().deleteMsg(id);
     }
 }
+
+void MailArchiverWidget::onHashBackfill()
+{
+    // Small batches keep the UI responsive: each message is decompressed and hashed again.
+    const int batchSize = 16;
+    bool pending        = false;
+    for (auto& m : archiveMgr->archivePool())
+        pending = m.second.migrateHashes(batchSize) || pending;
+    if (!pending)
+        hashBackfill->stop();
+}
+
+void MailArchiverWidget::onRecipientBackfill()
+{
+    const int batchSize = 16;
+    bool pending        = false;
+    for (auto& m : archiveMgr->archivePool())
+        pending = m.second.backfillRecipients(batchSize) || pending;
+    if (!pending)
+        recipientBackfill->stop();
+}
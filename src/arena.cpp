@@ -0,0 +1,86 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+// std
+#include <cstring>
+
+// local
+#include "arena.h"
+
+namespace Core
+{
+
+Arena::Arena(std::size_t blockSize) : m_Used(0), m_Reserved(0), m_BlockSize(blockSize), m_Allocations(0)
+{
+}
+
+char* Arena::allocate(std::size_t size)
+{
+    if (m_Blocks.empty() || m_Blocks.back().size - m_Used < size) {
+        Block block;
+        block.size = size > m_BlockSize ? size : m_BlockSize;
+        block.data.reset(new char[block.size]);
+        m_Reserved += block.size;
+        ++m_Allocations;
+        m_Blocks.push_back(std::move(block));
+        m_Used = 0;
+    }
+    char* result = m_Blocks.back().data.get() + m_Used;
+    m_Used += size;
+    return result;
+}
+
+void Arena::shrink(char* last, std::size_t used)
+{
+    if (!m_Blocks.empty())
+        m_Used = (last - m_Blocks.back().data.get()) + used;
+}
+
+std::string_view Arena::copy(std::string_view text)
+{
+    if (text.empty())
+        return std::string_view();
+    char* data = allocate(text.size());
+    std::memcpy(data, text.data(), text.size());
+    return std::string_view(data, text.size());
+}
+
+void Arena::reset()
+{
+    // One block covering everything the last message needed
+    if (m_Blocks.size() > 1) {
+        std::size_t size = m_Reserved;
+        m_Blocks.clear();
+        Block block;
+        block.size = size;
+        block.data.reset(new char[size]);
+        ++m_Allocations;
+        m_Blocks.push_back(std::move(block));
+        m_Reserved = size;
+    }
+    m_Used = 0;
+}
+
+std::size_t Arena::allocations() const
+{
+    return m_Allocations;
+}
+}
@@ -20,32 +20,316 @@
 **************************************************************************/
 
 // std
-#include <iostream>
-#include <chrono>
-#include <ctime>
+#include <fstream>
 #include <cstdint>
-#include <iomanip>
-#include <sstream>
+#include <cstdio>
 #include <cstring> //memset
 #include <stdexcept>
 #include <algorithm>
-#include <codecvt>
+#include <iterator>
+#include <list>
+#include <vector>
 
 // local
 #include "msg.h"
-#include "md5.hh"
+#include "rtf.h"
+#include "unicode.h"
+#include "utils.h"
 
 namespace Core
 {
 
+namespace
+{
+const uint16_t PT_LONG    = 0x0003;
+const uint16_t PT_BOOLEAN = 0x000B;
+const uint16_t PT_I8      = 0x0014;
+const uint16_t PT_STRING8 = 0x001E;
+const uint16_t PT_UNICODE = 0x001F;
+const uint16_t PT_BINARY  = 0x0102;
+const uint16_t PT_SYSTIME = 0x0040;
+
+const uint16_t PR_IMPORTANCE            = 0x0017;
+const uint16_t PR_CLIENT_SUBMIT_TIME    = 0x0039;
+const uint16_t PR_MESSAGE_DELIVERY_TIME = 0x0E06;
+const uint16_t PR_MESSAGE_FLAGS         = 0x0E07;
+const uint16_t PR_MESSAGE_SIZE          = 0x0E08;
+const uint16_t PR_LEGACY_SENT_TIME      = 0x8008; // named property some clients use for the sent time
+
+const uint16_t PR_RECIPIENT_TYPE = 0x0C15;
+const uint16_t PR_DISPLAY_NAME   = 0x3001;
+const uint16_t PR_EMAIL_ADDRESS  = 0x3003;
+const uint16_t PR_SMTP_ADDRESS   = 0x39FE;
+
+const uint16_t PR_INTERNET_CPID    = 0x3FDE;
+const uint16_t PR_MESSAGE_CODEPAGE = 0x3FFD;
+
+const uint16_t PR_BODY                 = 0x1000;
+const uint16_t PR_RTF_COMPRESSED        = 0x1009;
+const uint16_t PR_HTML                  = 0x1013;
+const uint16_t PR_ATTACH_FILENAME      = 0x3704;
+const uint16_t PR_ATTACH_LONG_FILENAME = 0x3707;
+
+const uint16_t PR_CREATION_TIME          = 0x3007;
+const uint16_t PR_LAST_MODIFICATION_TIME = 0x3008;
+
+// PR_ATTACH_DATA_BIN inside an attachment storage
+const char* const AttachmentDataStream = "/__substg1.0_37010102";
+// PR_ATTACH_DATA_OBJ, the storage of an embedded message
+const char* const EmbeddedMessageStorage = "__substg1.0_3701000D";
+
+// A properties stream starts with a header, 32 bytes for the top level message and 8 bytes for
+// recipients and attachments, followed by 16 byte entries
+const std::size_t PropertiesHeaderSize = 32;
+const std::size_t SubObjectHeaderSize  = 8;
+const std::size_t EmbeddedHeaderSize   = 24;
+const std::size_t PropertyEntrySize    = 16;
+const std::size_t RecipientPrefixSize  = 20; // "__recip_version1.0_#"
+const std::size_t AttachmentPrefixSize = 21; // "__attach_version1.0_#"
+
+enum Field { SenderName, SenderAddress, Subject, Bcc, CC, ReceiversNames, ReceiversAddresses, FieldCount };
+const int MaxFallbacks = 6;
+
+// Property tags feeding each field, most preferred first, zero terminated
+const uint16_t fieldTags[FieldCount][MaxFallbacks] = {
+    {0x0C1A, 0x3FFA, 0x0042},                         // SenderName
+    {0x0065, 0x0C1F, 0x800B, 0x3FFA, 0x5D01, 0x5D02}, // SenderAddress
+    {0x0070, 0x0E1D, 0x0037},                         // Subject
+    {0x0E02},                                         // Bcc
+    {0x0E03},                                         // CC
+    {0x0E04},                                         // ReceiversNames
+    {0x5D01, 0x5D09},                                 // ReceiversAddresses
+};
+
+// String properties read from each recipient storage, and from each attachment storage
+const int RecipientTagCount                     = 3;
+const uint16_t recipientTags[RecipientTagCount] = {PR_DISPLAY_NAME, PR_SMTP_ADDRESS, PR_EMAIL_ADDRESS};
+const int AttachmentTagCount                      = 2;
+const uint16_t attachmentTags[AttachmentTagCount] = {PR_ATTACH_LONG_FILENAME, PR_ATTACH_FILENAME};
+
+// The FieldMask bit requesting each field
+const unsigned fieldMasks[FieldCount] = {Msg::SenderFields, Msg::SenderFields, Msg::SubjectField,
+                                         Msg::BccField,      Msg::CCField,      Msg::ReceiverFields,
+                                         Msg::ReceiverFields};
+
+// The forms the body can be stored in; the root scan notes which are present for loadBody()
+enum BodyStream : unsigned {
+    UnicodeBody     = 1 << 0, // PR_BODY
+    EightBitBody    = 1 << 1,
+    RtfBody         = 1 << 2, // PR_RTF_COMPRESSED
+    HtmlBody        = 1 << 3, // PR_HTML, binary
+    UnicodeHtmlBody = 1 << 4
+};
+
+unsigned bodyStream(uint16_t tag, uint16_t type)
+{
+    if (tag == PR_BODY)
+        return type == PT_UNICODE ? UnicodeBody : type == PT_STRING8 ? EightBitBody : 0;
+    if (tag == PR_RTF_COMPRESSED && type == PT_BINARY)
+        return RtfBody;
+    if (tag == PR_HTML)
+        return type == PT_BINARY ? HtmlBody : type == PT_UNICODE ? UnicodeHtmlBody : 0;
+    return 0;
+}
+
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+POLE::ByteSpan bytesOf(const std::string& data)
+{
+    return POLE::ByteSpan(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+}
+
+uint32_t readU32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t readU64(const unsigned char* p)
+{
+    return readU32(p) | (static_cast<uint64_t>(readU32(p + 4)) << 32);
+}
+
+// FILETIME counts 100ns ticks since 1601-01-01 UTC
+int64_t fileTimeToUnix(uint64_t fileTime)
+{
+    return static_cast<int64_t>(fileTime / 10000000u) - INT64_C(11644473600);
+}
+
+// "YYYY-MM-DD" or "YYYY-MM-DD HH:MM:SS" in UTC, using days-to-civil integer arithmetic
+std::string formatUnixTime(int64_t seconds, bool withTime)
+{
+    int64_t days = seconds / 86400;
+    int64_t secs = seconds % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        --days;
+    }
+
+    days += 719468; // shift the epoch to 0000-03-01
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const int64_t doe = days - era * 146097;
+    const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int64_t mp   = (5 * doy + 2) / 153;
+    const int64_t day  = doy - (153 * mp + 2) / 5 + 1;
+    const int64_t mon  = mp < 10 ? mp + 3 : mp - 9;
+    const int64_t year = yoe + era * 400 + (mon <= 2);
+
+    char text[32];
+    if (withTime)
+        std::snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:%02d:%02d", static_cast<int>(year),
+                      static_cast<int>(mon), static_cast<int>(day), static_cast<int>(secs / 3600),
+                      static_cast<int>(secs / 60 % 60), static_cast<int>(secs % 60));
+    else
+        std::snprintf(text, sizeof(text), "%04d-%02d-%02d", static_cast<int>(year), static_cast<int>(mon),
+                      static_cast<int>(day));
+    return text;
+}
+
+// Keeps the PT_LONG, PT_BOOLEAN, PT_I8 and PT_SYSTIME entries of a properties stream
+void parseFixedProperties(POLE::ByteSpan bytes, std::size_t headerSize,
+                          std::vector<FixedProperty>& properties)
+{
+    properties.clear();
+    if (bytes.size > headerSize)
+        properties.reserve((bytes.size - headerSize) / PropertyEntrySize);
+    for (std::size_t pos = headerSize; pos + PropertyEntrySize <= bytes.size; pos += PropertyEntrySize) {
+        const unsigned char* entry = bytes.data + pos;
+        uint32_t tag               = readU32(entry);
+        FixedProperty property;
+        property.id    = static_cast<uint16_t>(tag >> 16);
+        property.type  = static_cast<uint16_t>(tag & 0xFFFF);
+        property.flags = readU32(entry + 4);
+        switch (property.type) {
+        case PT_LONG:
+        case PT_BOOLEAN:
+            property.value = readU32(entry + 8);
+            break;
+        case PT_I8:
+        case PT_SYSTIME:
+            property.value = readU64(entry + 8);
+            break;
+        default:
+            continue;
+        }
+        properties.push_back(property);
+    }
+}
+
+// Properties that change when a message is saved again, not when its content changes
+bool isVolatileProperty(uint16_t id)
+{
+    return id == PR_MESSAGE_FLAGS || id == PR_MESSAGE_SIZE || id == PR_CREATION_TIME ||
+           id == PR_LAST_MODIFICATION_TIME;
+}
+
+void hashValue(Utils::ContentHasher& hasher, uint64_t value)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; ++i) bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+    hasher.update(bytes, sizeof(bytes));
+}
+
+void hashBytes(Utils::ContentHasher& hasher, const unsigned char* data, std::size_t len)
+{
+    hashValue(hasher, len);
+    hasher.update(data, len);
+}
+
+// Splits "__substg1.0_TTTTYYYY" into its property tag and type
+bool parsePropertyName(const std::string& name, uint16_t& tag, uint16_t& type)
+{
+    if (name.size() != 20 || name.compare(0, 12, "__substg1.0_") != 0)
+        return false;
+    uint32_t value = 0;
+    for (size_t i = 12; i < 20; ++i) {
+        int digit = hexDigit(name[i]);
+        if (digit < 0)
+            return false;
+        value = (value << 4) | static_cast<uint32_t>(digit);
+    }
+    tag  = static_cast<uint16_t>(value >> 16);
+    type = static_cast<uint16_t>(value & 0xFFFF);
+    return true;
+}
+
+// Queues the string stream of each tag of a recipient or attachment storage, found with one listing of
+// the storage: the PT_UNICODE form, else the PT_STRING8 one, else an empty name that reads as nothing.
+void locateStrings(POLE::Storage* file, const std::string& storage, const uint16_t* tags, int count,
+                   std::list<std::string>& names, std::vector<bool>& eightBit)
+{
+    std::vector<std::string> found(count);
+    std::vector<uint16_t> types(count, 0);
+    for (const std::string& name : file->entries(storage)) {
+        uint16_t tag, type;
+        if (!parsePropertyName(name, tag, type) || (type != PT_UNICODE && type != PT_STRING8))
+            continue;
+        for (int i = 0; i < count; ++i)
+            if (tags[i] == tag && types[i] != PT_UNICODE) {
+                found[i] = storage + "/" + name;
+                types[i] = type;
+            }
+    }
+    for (int i = 0; i < count; ++i) {
+        names.push_back(std::move(found[i]));
+        eightBit.push_back(types[i] == PT_STRING8);
+    }
+}
+
+// The code page of the PT_STRING8 properties: PR_INTERNET_CPID, else PR_MESSAGE_CODEPAGE
+unsigned messageCodepage(const std::vector<FixedProperty>& properties)
+{
+    unsigned codepage = Utils::DefaultCodepage;
+    for (const FixedProperty& property : properties) {
+        if (property.type != PT_LONG || !Utils::codepage_supported(static_cast<unsigned>(property.value)))
+            continue;
+        if (property.id == PR_INTERNET_CPID)
+            return static_cast<unsigned>(property.value);
+        if (property.id == PR_MESSAGE_CODEPAGE)
+            codepage = static_cast<unsigned>(property.value);
+    }
+    return codepage;
+}
+}
+
 // Cosntructors:
-Msg::Msg() : m_File(nullptr), m_Opened(false)
+Msg::Msg()
+    : m_File(nullptr), m_Arena(nullptr), m_Opened(false), m_Error(Error::None), m_Fields(AllFields),
+      m_HashAlgorithm(Utils::HashAlgorithm::MD5), m_SentTime(0), m_hasSentTime(false),
+      m_hasAttachments(false), m_Codepage(Utils::DefaultCodepage), m_BodyStreams(0)
 {
 }
 
-Msg::Msg(const std::string& filename) : m_File(nullptr), m_Opened(false), m_FileName(filename)
+Msg::Msg(const std::string& filename, unsigned fields)
+    : m_File(nullptr), m_Arena(nullptr), m_Opened(false), m_Error(Error::None), m_Fields(fields),
+      m_FileName(filename), m_HashAlgorithm(Utils::HashAlgorithm::MD5), m_SentTime(0), m_hasSentTime(false),
+      m_hasAttachments(false), m_Codepage(Utils::DefaultCodepage), m_BodyStreams(0)
 {
-    open(filename.c_str());
+    open(filename.c_str(), fields);
+}
+
+Msg::Msg(Arena& arena)
+    : m_File(nullptr), m_Arena(&arena), m_Opened(false), m_Error(Error::None), m_Fields(AllFields),
+      m_HashAlgorithm(Utils::HashAlgorithm::MD5), m_SentTime(0), m_hasSentTime(false),
+      m_hasAttachments(false), m_Codepage(Utils::DefaultCodepage), m_BodyStreams(0)
+{
+}
+
+Msg::Msg(const std::string& filename, Arena& arena, unsigned fields)
+    : m_File(nullptr), m_Arena(&arena), m_Opened(false), m_Error(Error::None), m_Fields(fields),
+      m_FileName(filename), m_HashAlgorithm(Utils::HashAlgorithm::MD5), m_SentTime(0), m_hasSentTime(false),
+      m_hasAttachments(false), m_Codepage(Utils::DefaultCodepage), m_BodyStreams(0)
+{
+    open(filename.c_str(), fields);
 }
 
 // Getters
@@ -54,39 +338,44 @@ const std::string Msg::fileName()
     return m_FileName;
 }
 
+unsigned Msg::fields()
+{
+    return m_Fields;
+}
+
 const std::string Msg::senderName()
 {
-    return m_SenderName;
+    return std::string(m_SenderName);
 }
 
 const std::string Msg::senderAddress()
 {
-    return m_SenderAddress;
+    return std::string(m_SenderAddress);
 }
 
 const std::string Msg::receiversNames()
 {
-    return m_ReceiversNames;
+    return std::string(m_ReceiversNames);
 }
 
 const std::string Msg::receiversAddresses()
 {
-    return m_ReceiversAddresses;
+    return std::string(m_ReceiversAddresses);
 }
 
 const std::string Msg::CCs()
 {
-    return m_CC;
+    return std::string(m_CC);
 }
 
 const std::string Msg::Bccs()
 {
-    return m_Bcc;
+    return std::string(m_Bcc);
 }
 
 const std::string Msg::subject()
 {
-    return m_Subject;
+    return std::string(m_Subject);
 }
 
 const std::string Msg::date()
@@ -94,210 +383,592 @@ const std::string Msg::date()
     return m_date;
 }
 
+const std::string Msg::dateTime()
+{
+    return m_hasSentTime ? formatUnixTime(m_SentTime, true) : std::string();
+}
+
+int64_t Msg::sentTime()
+{
+    return m_SentTime;
+}
+
+int64_t Msg::receivedTime()
+{
+    const FixedProperty* received = fixedProperty(PR_MESSAGE_DELIVERY_TIME);
+    return (received && received->type == PT_SYSTIME) ? fileTimeToUnix(received->value) : 0;
+}
+
+int32_t Msg::messageSize()
+{
+    const FixedProperty* size = fixedProperty(PR_MESSAGE_SIZE);
+    return size ? static_cast<int32_t>(size->value) : 0;
+}
+
+int32_t Msg::importance()
+{
+    const FixedProperty* importance = fixedProperty(PR_IMPORTANCE);
+    return importance ? static_cast<int32_t>(importance->value) : 1; // normal
+}
+
+int32_t Msg::messageFlags()
+{
+    const FixedProperty* flags = fixedProperty(PR_MESSAGE_FLAGS);
+    return flags ? static_cast<int32_t>(flags->value) : 0;
+}
+
+const std::vector<Recipient>& Msg::recipients()
+{
+    return m_Recipients;
+}
+
+const std::vector<Attachment>& Msg::attachments()
+{
+    return m_Attachments;
+}
+
+std::string Msg::attachmentData(const Attachment& attachment)
+{
+    std::string data;
+    if (!m_Opened)
+        return data;
+    POLE::Stream stream(m_File, std::string(attachment.storage) + AttachmentDataStream);
+    // view() is bounded by the sectors the stream really has, not by the size its entry claims
+    POLE::ByteSpan bytes = stream.view();
+    data.assign(reinterpret_cast<const char*>(bytes.data), static_cast<std::size_t>(bytes.size));
+    return data;
+}
+
+// Writes data back over the PR_ATTACH_DATA_BIN sectors of storage, in a whole .msg image
+bool Msg::restoreAttachment(std::string& msgBytes, const std::string& storage, const std::string& data)
+{
+    std::list<POLE::Extent> extents;
+    {
+        POLE::Storage image(reinterpret_cast<const unsigned char*>(msgBytes.data()), msgBytes.size());
+        if (!image.open())
+            return false;
+        POLE::Stream stream(&image, storage + AttachmentDataStream);
+        if (stream.fail() || stream.size() != data.size())
+            return false;
+        extents = stream.extents();
+    }
+
+    std::size_t done = 0;
+    for (const POLE::Extent& extent : extents) {
+        std::memcpy(&msgBytes[extent.offset], data.data() + done, extent.length);
+        done += extent.length;
+    }
+    return done == data.size();
+}
+
+POLE::ByteSpan Msg::rawBytes()
+{
+    if (!m_Opened || !m_File->mappedBytes())
+        return POLE::ByteSpan();
+    return POLE::ByteSpan(m_File->mappedBytes(), m_File->fileSize());
+}
+
+uint64_t Msg::bytesRead()
+{
+    return rawBytes().size;
+}
+
+const std::vector<FixedProperty>& Msg::fixedProperties()
+{
+    return m_Properties;
+}
+
+const FixedProperty* Msg::fixedProperty(uint16_t id)
+{
+    for (const FixedProperty& property : m_Properties)
+        if (property.id == id)
+            return &property;
+    return nullptr;
+}
+
 void Msg::loadBody()
 {
-    if (m_body.empty() && m_Opened) {
+    if (!m_body.empty() || !m_Opened || !(m_Fields & BodyField))
+        return;
+    // Only the forms the root scan found are opened
+    if (m_BodyStreams & UnicodeBody)
         m_body = getStringFromStream("__substg1.0_1000001F");
+    if (m_body.empty() && (m_BodyStreams & EightBitBody)) {
+        POLE::Stream body(m_File, "__substg1.0_1000001E");
+        m_body = getString8FromBytes(body.view());
+    }
+    if (!m_body.empty())
+        return;
+
+    // No plain text body: Outlook often stores only the RTF or HTML form, so derive the text from those
+    std::string text;
+    if (m_BodyStreams & RtfBody) {
+        POLE::Stream rtf(m_File, "__substg1.0_10090102");
+        POLE::ByteSpan bytes = rtf.view();
+        Utils::compressed_rtf_to_text(bytes.data, static_cast<std::size_t>(bytes.size), text);
     }
+    if (text.empty()) {
+        if (m_BodyStreams & HtmlBody) {
+            // The binary form is in the message code page, like PT_STRING8 text
+            POLE::Stream html(m_File, "__substg1.0_10130102");
+            std::string_view utf8 = getString8FromBytes(html.view());
+            Utils::html_to_text(utf8.data(), utf8.size(), text);
+        } else if (m_BodyStreams & UnicodeHtmlBody) {
+            std::string_view unicode = getStringFromStream("__substg1.0_1013001F");
+            Utils::html_to_text(unicode.data(), unicode.size(), text);
+        }
+    }
+    if (!text.empty())
+        m_body = arena().copy(text);
 }
 
-const std::string& Msg::body()
+const std::string Msg::body()
 {
     loadBody();
-    return m_body;
+    return std::string(m_body);
 }
 
 const std::string Msg::hash()
 {
-    if (m_hash.empty()) {
-        MD5 md5(m_File->internalFile());
-        m_hash.assign(md5.hex_digest());
+    if (m_hash.empty() && m_Opened) {
+        POLE::ByteSpan bytes = rawBytes();
+        m_hash = Utils::content_hash_hex(m_HashAlgorithm, bytes.data, bytes.size);
     }
     return m_hash;
 }
 
+const std::string Msg::contentHash()
+{
+    if (m_contentHash.empty() && m_Opened) {
+        Utils::ContentHasher hasher(m_HashAlgorithm);
+        hashStorage("/", PropertiesHeaderSize, hasher);
+        m_contentHash = hasher.hexDigest();
+    }
+    return m_contentHash;
+}
+
+void Msg::setHashAlgorithm(Utils::HashAlgorithm algorithm)
+{
+    if (algorithm != m_HashAlgorithm) {
+        m_hash.clear();
+        m_contentHash.clear();
+    }
+    m_HashAlgorithm = algorithm;
+}
+
+Utils::HashAlgorithm Msg::hashAlgorithm()
+{
+    return m_HashAlgorithm;
+}
+
 bool Msg::hasAttachments()
 {
     return m_hasAttachments;
 }
 
+MsgRecord Msg::record()
+{
+    hash();
+    loadBody();
+
+    MsgRecord rec;
+    rec.hash               = m_hash;
+    rec.senderName         = m_SenderName;
+    rec.senderAddress      = m_SenderAddress;
+    rec.receiversNames     = m_ReceiversNames;
+    rec.receiversAddresses = m_ReceiversAddresses;
+    rec.CCs                = m_CC;
+    rec.Bccs               = m_Bcc;
+    rec.subject            = m_Subject;
+    rec.date               = m_date;
+    rec.body               = m_body;
+    rec.fileName           = m_FileName;
+    rec.recipients         = &m_Recipients;
+    rec.attachments        = &m_Attachments;
+    rec.hasAttachments     = m_hasAttachments;
+    return rec;
+}
+
 // Protected
-void Msg::visit(int indent, POLE::Storage* storage, std::string path)
+
+// Feeds a storage to hasher in a layout independent form: its children in name order (which sorts the
+// property streams by tag), streams by their contents, and the properties stream by its tags and values
+// sorted by tag, leaving out the volatile ones. Sub-storages, i.e. recipients, attachments and embedded
+// messages, are fed the same way.
+void Msg::hashStorage(const std::string& path, std::size_t headerSize, Utils::ContentHasher& hasher)
 {
-    std::list<std::string> entries;
-    entries = storage->entries(path);
+    std::list<std::string> entries = m_File->entries(path);
+    entries.sort();
+    for (const std::string& name : entries) {
+        const std::string fullName = path + name;
+        hashBytes(hasher, reinterpret_cast<const unsigned char*>(name.data()), name.size());
+        if (m_File->isDirectory(fullName)) {
+            const bool embedded = name == EmbeddedMessageStorage;
+            hashStorage(fullName + "/", embedded ? EmbeddedHeaderSize : SubObjectHeaderSize, hasher);
+            continue;
+        }
+
+        POLE::Stream stream(m_File, fullName);
+        if (stream.fail())
+            continue;
+        POLE::ByteSpan bytes = stream.view();
+        if (name != "__properties_version1.0") {
+            hashBytes(hasher, bytes.data, bytes.size);
+            continue;
+        }
+
+        std::vector<std::pair<uint32_t, uint64_t>> properties;
+        for (std::size_t pos = headerSize; pos + PropertyEntrySize <= bytes.size; pos += PropertyEntrySize) {
+            uint32_t tag = readU32(bytes.data + pos);
+            if (!isVolatileProperty(static_cast<uint16_t>(tag >> 16)))
+                properties.emplace_back(tag, readU64(bytes.data + pos + 8));
+        }
+        std::sort(properties.begin(), properties.end());
+        hashValue(hasher, properties.size());
+        for (const auto& property : properties) {
+            hashValue(hasher, property.first);
+            hashValue(hasher, property.second);
+        }
+    }
+}
 
-    std::list<std::string>::iterator it;
-    for (it = entries.begin(); it != entries.end(); ++it) {
-        std::string name     = *it;
+// Appends the entries under path to listing, one per line, with the size of each stream
+void Msg::visit(int indent, const std::string& path, std::string& listing)
+{
+    for (const std::string& name : m_File->entries(path)) {
         std::string fullname = path + name;
-        for (int j = 0; j < indent; j++) std::cout << "    ";
-        POLE::Stream* ss = new POLE::Stream(storage, fullname);
-        std::cout << name;
-        if (ss)
-            if (!ss->fail())
-                std::cout << "  (" << ss->size() << ")";
-        std::cout << std::endl;
-        delete ss;
-
-        if (storage->isDirectory(fullname))
-            visit(indent + 1, storage, fullname + "/");
+        listing.append(4 * indent, ' ');
+        listing += name;
+        POLE::Stream stream(m_File, fullname);
+        if (!stream.fail())
+            listing += "  (" + std::to_string(stream.size()) + ")";
+        listing += '\n';
+
+        if (m_File->isDirectory(fullname))
+            visit(indent + 1, fullname + "/", listing);
     }
 }
 
 // Open
-bool Msg::open(const char* arg1)
+Msg::Error Msg::open(const char* arg1, unsigned fields)
 {
-    if (m_Opened) {
-        close();
-    }
+    close();
+    m_Fields = fields;
 
     m_File   = new POLE::Storage(arg1);
+    m_Opened = m_File->openMapped();
+    if (!m_Opened && m_File->result() == POLE::Storage::OpenFailed) {
+        // Cannot be mapped (e.g. a pipe or an empty file): read it whole in one pass instead, so the
+        // parser, the hash and the archive blob still share the same bytes
+        delete m_File;
+        m_File = nullptr;
+        std::ifstream file(arg1, std::ios::binary);
+        if (!file) {
+            m_Error = Error::OpenFailed;
+            return Error::OpenFailed;
+        }
+        m_Buffer.reset(new std::string(std::istreambuf_iterator<char>(file), {}));
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(m_Buffer->data());
+        m_File   = new POLE::Storage(bytes, m_Buffer->size());
+        m_Opened = m_File->open();
+    }
+    return finishOpen();
+}
+
+// Open a whole .msg file already held in memory, without touching the disk
+Msg::Error Msg::openBuffer(std::string contents, unsigned fields)
+{
+    close();
+    m_Fields = fields;
+
+    m_Buffer.reset(new std::string(std::move(contents)));
+    m_File = new POLE::Storage(reinterpret_cast<const unsigned char*>(m_Buffer->data()), m_Buffer->size());
     m_Opened = m_File->open();
+    return finishOpen();
+}
+
+// Parses what the field mask asks for once the storage is open, else tells why it is not
+Msg::Error Msg::finishOpen()
+{
+    Error error = Error::None;
     if (m_Opened) {
-        // Look for Sender Name
-        m_SenderName = getStringFromStream("__substg1.0_0C1A001F");
-        if (m_SenderName.empty())
-            m_SenderName = getStringFromStream("__substg1.0_3FFA001F");
-        if (m_SenderName.empty())
-            m_SenderName = getStringFromStream("__substg1.0_0042001F");
-
-        // Sender Address
-        m_SenderAddress = getStringFromStream("__substg1.0_0065001F");
-        if (m_SenderAddress.empty())
-            m_SenderAddress = getStringFromStream("__substg1.0_0C1F001F");
-        if (m_SenderAddress.empty())
-            m_SenderAddress = getStringFromStream("__substg1.0_800B001F");
-        if (m_SenderAddress.empty())
-            m_SenderAddress = getStringFromStream("__substg1.0_3FFA001F");
-        if (m_SenderAddress.empty())
-            m_SenderAddress = getStringFromStream("__substg1.0_5D01001F");
-        if (m_SenderAddress.empty())
-            m_SenderAddress = getStringFromStream("__substg1.0_5D02001F");
-
-        // Subject
-        m_Subject = getStringFromStream("__substg1.0_0070001F");
-        if (m_Subject.empty())
-            m_Subject = getStringFromStream("__substg1.0_0E1D001F");
-        if (m_Subject.empty())
-            m_Subject = getStringFromStream("__substg1.0_0037001F");
-
-        std::transform(m_Subject.begin(), m_Subject.end(), m_Subject.begin(), [](char c) -> char {
-            if (c == '\'')
-                return '\"';
-            else
-                return c;
-        });
-
-        // BCC
-        m_Bcc = getStringFromStream("__substg1.0_0E02001F");
-        // CC
-        m_CC = getStringFromStream("__substg1.0_0E03001F");
-
-        // Receivers Names
-        m_ReceiversNames = getStringFromStream("__substg1.0_0E04001F");
-
-        // Receivers Addresses
-        m_ReceiversAddresses = getStringFromStream("__substg1.0_5D01001F");
-        if (m_ReceiversAddresses.empty())
-            m_ReceiversAddresses = getStringFromStream("__substg1.0_5D09001F");
-
-        // Sent date
-        m_date = getDateTimeFromStream("__properties_version1.0");
-
-        // If has attachments.
-        m_hasAttachments = m_File->exists("__attach_version1.0_#00000000");
+        readProperties();
+    } else {
+        switch (m_File->result()) {
+        case POLE::Storage::OpenFailed:
+            error = Error::OpenFailed;
+            break;
+        case POLE::Storage::NotOLE:
+            error = Error::NotCompoundFile;
+            break;
+        default:
+            error = Error::BadCompoundFile;
+            break;
+        }
+    }
+    m_Error = error;
+    return error;
+}
+
+Msg::Error Msg::error()
+{
+    return m_Error;
+}
+
+void Msg::readProperties()
+{
+    if (m_Fields == NoFields)
+        return;
+
+    // The root is enumerated once: each __substg1.0_ entry lands in the slot of every field that
+    // accepts its tag, and the fallbacks of a field are then resolved in memory. A PT_STRING8 entry
+    // only takes a slot the PT_UNICODE form of the same tag has not.
+    std::list<std::string> names;
+    std::vector<bool> eightBit; // per name, whether it holds PT_STRING8 text
+    std::vector<std::string> recipientStorages;
+    std::vector<std::string> attachmentStorages;
+    int fixed          = -1;
+    bool hasProperties = false;
+    int slots[FieldCount][MaxFallbacks];
+    uint16_t slotTypes[FieldCount][MaxFallbacks] = {};
+    std::fill(&slots[0][0], &slots[0][0] + FieldCount * MaxFallbacks, -1);
+
+    // Only what the field mask asks for is located, then read
+    for (const std::string& name : m_File->entries("/")) {
+        uint16_t tag, type;
+        if (!parsePropertyName(name, tag, type)) {
+            if (name.compare(0, AttachmentPrefixSize, "__attach_version1.0_#") == 0) {
+                if (m_Fields & AttachmentsField)
+                    attachmentStorages.push_back(name);
+            } else if (name.compare(0, RecipientPrefixSize, "__recip_version1.0_#") == 0) {
+                if (m_Fields & RecipientsField)
+                    recipientStorages.push_back(name);
+            } else if (name == "__properties_version1.0") {
+                hasProperties = true;
+                if (m_Fields & PropertiesFields) {
+                    fixed = static_cast<int>(names.size());
+                    names.push_back(name);
+                    eightBit.push_back(false);
+                }
+            }
+            continue;
+        }
+        if (m_Fields & BodyField)
+            m_BodyStreams |= bodyStream(tag, type);
+        if (type != PT_UNICODE && type != PT_STRING8)
+            continue;
+        int index = -1;
+        for (int field = 0; field < FieldCount; ++field) {
+            if (!(m_Fields & fieldMasks[field]))
+                continue;
+            for (int priority = 0; priority < MaxFallbacks && fieldTags[field][priority]; ++priority)
+                if (fieldTags[field][priority] == tag && slotTypes[field][priority] != PT_UNICODE) {
+                    if (index < 0) {
+                        index = static_cast<int>(names.size());
+                        names.push_back(name);
+                        eightBit.push_back(type == PT_STRING8);
+                    }
+                    slots[field][priority]     = index;
+                    slotTypes[field][priority] = type;
+                }
+        }
+    }
+
+    // Each recipient storage contributes its display name, addresses and recipient type
+    const int firstRecipient = static_cast<int>(names.size());
+    std::sort(recipientStorages.begin(), recipientStorages.end());
+    for (const std::string& storage : recipientStorages) {
+        locateStrings(m_File, storage, recipientTags, RecipientTagCount, names, eightBit);
+        names.push_back(storage + "/__properties_version1.0");
+        eightBit.push_back(false);
+    }
+
+    // Attachments contribute their long and short file names
+    const int firstAttachment = static_cast<int>(names.size());
+    std::sort(attachmentStorages.begin(), attachmentStorages.end());
+    for (const std::string& storage : attachmentStorages)
+        locateStrings(m_File, storage, attachmentTags, AttachmentTagCount, names, eightBit);
+
+    // 8-bit text needs the code page from the properties stream, even when its values were not asked for
+    const bool needCodepage =
+        (m_BodyStreams & EightBitBody) || std::find(eightBit.begin(), eightBit.end(), true) != eightBit.end();
+    if (fixed < 0 && hasProperties && needCodepage) {
+        fixed = static_cast<int>(names.size());
+        names.push_back("__properties_version1.0");
+        eightBit.push_back(false);
+    }
+
+    // Only the streams that exist are read, in a single pass over the file.
+    std::list<std::string> contents = m_File->readStreams(names);
+    std::vector<std::string> streams(std::make_move_iterator(contents.begin()),
+                                     std::make_move_iterator(contents.end()));
+
+    std::vector<FixedProperty> properties;
+    if (fixed >= 0) {
+        if (m_Fields & PropertiesFields) {
+            readFixedProperties(bytesOf(streams[fixed]));
+            m_Codepage = messageCodepage(m_Properties);
+        } else {
+            parseFixedProperties(bytesOf(streams[fixed]), PropertiesHeaderSize, properties);
+            m_Codepage = messageCodepage(properties);
+        }
+    }
+
+    auto text = [&](std::size_t index) {
+        POLE::ByteSpan bytes = bytesOf(streams[index]);
+        return eightBit[index] ? getString8FromBytes(bytes) : getStringFromBytes(bytes);
+    };
+    auto property = [&](int field) {
+        std::string_view value;
+        for (int priority = 0; priority < MaxFallbacks && value.empty(); ++priority)
+            if (slots[field][priority] >= 0)
+                value = text(slots[field][priority]);
+        return value;
+    };
+
+    m_SenderName         = property(SenderName);
+    m_SenderAddress      = property(SenderAddress);
+    m_Subject            = property(Subject);
+    m_Bcc                = property(Bcc);
+    m_CC                 = property(CC);
+    m_ReceiversNames     = property(ReceiversNames);
+    m_ReceiversAddresses = property(ReceiversAddresses);
+
+    // The subject text was just decoded into this message's arena
+    char* subject = const_cast<char*>(m_Subject.data());
+    std::replace(subject, subject + m_Subject.size(), '\'', '\"');
+
+    m_Recipients.clear();
+    m_Recipients.reserve(recipientStorages.size());
+    for (std::size_t i = 0; i < recipientStorages.size(); ++i) {
+        const std::size_t recip = firstRecipient + i * (RecipientTagCount + 1);
+        Recipient recipient;
+        recipient.type    = Recipient::To;
+        recipient.name    = text(recip);
+        recipient.address = text(recip + 1);
+        if (recipient.address.empty())
+            recipient.address = text(recip + 2);
+        parseFixedProperties(bytesOf(streams[recip + 3]), SubObjectHeaderSize, properties);
+        for (const FixedProperty& property : properties)
+            if (property.id == PR_RECIPIENT_TYPE && property.type == PT_LONG)
+                recipient.type = static_cast<int32_t>(property.value & 0xFF);
+        m_Recipients.push_back(recipient);
+    }
+
+    // The attachment bytes themselves are not read here, only located
+    m_Attachments.clear();
+    m_Attachments.reserve(attachmentStorages.size());
+    for (std::size_t i = 0; i < attachmentStorages.size(); ++i) {
+        const std::size_t fileNames = firstAttachment + i * AttachmentTagCount;
+        Attachment attachment;
+        attachment.storage  = arena().copy(attachmentStorages[i]);
+        attachment.fileName = text(fileNames);
+        if (attachment.fileName.empty())
+            attachment.fileName = text(fileNames + 1);
+        POLE::Stream data(m_File, attachmentStorages[i] + AttachmentDataStream);
+        attachment.size = data.fail() ? 0 : data.size();
+        if (attachment.size)
+            attachment.extents = data.extents();
+        m_Attachments.push_back(std::move(attachment));
+    }
+    m_hasAttachments = !m_Attachments.empty();
+}
+
+// Walks the fixed size entries of the properties stream once, keeping the scalar values
+void Msg::readFixedProperties(POLE::ByteSpan bytes)
+{
+    parseFixedProperties(bytes, PropertiesHeaderSize, m_Properties);
+
+    // Sent date: submit time, else delivery time, else the legacy named property
+    const uint16_t sentTags[] = {PR_CLIENT_SUBMIT_TIME, PR_MESSAGE_DELIVERY_TIME, PR_LEGACY_SENT_TIME};
+    for (uint16_t id : sentTags) {
+        const FixedProperty* sent = fixedProperty(id);
+        if (sent && sent->type == PT_SYSTIME) {
+            m_SentTime    = fileTimeToUnix(sent->value);
+            m_hasSentTime = true;
+            m_date        = formatUnixTime(m_SentTime, false);
+            break;
+        }
     }
-    return m_Opened;
 }
 
 // Close
 void Msg::close()
 {
-    m_File->close();
-    m_SenderName.clear();
-    m_SenderAddress.clear();
-    m_ReceiversNames.clear();
-    m_ReceiversAddresses.clear();
-    m_Subject.clear();
-    m_CC.clear();
-    m_Bcc.clear();
+    if (m_File) {
+        m_File->close();
+        delete m_File;
+        m_File = nullptr;
+    }
+    m_Buffer.reset();
+    m_SenderName         = std::string_view();
+    m_SenderAddress      = std::string_view();
+    m_ReceiversNames     = std::string_view();
+    m_ReceiversAddresses = std::string_view();
+    m_Subject            = std::string_view();
+    m_CC                 = std::string_view();
+    m_Bcc                = std::string_view();
     m_date.clear();
-    m_body.clear();
+    m_body = std::string_view();
+    if (m_Arena)
+        m_Arena->reset();
+    m_hash.clear();
+    m_contentHash.clear();
+    m_Properties.clear();
+    m_Recipients.clear();
+    m_Attachments.clear();
+    m_SentTime       = 0;
+    m_hasSentTime    = false;
     m_hasAttachments = false;
+    m_Codepage       = Utils::DefaultCodepage;
+    m_BodyStreams    = 0;
     m_Opened         = false;
-
-    delete m_File;
+    m_Error          = Error::None;
 }
 
-const std::string Msg::getDateTimeFromStream(const char* stream)
+std::string_view Msg::getStringFromStream(const char* stream)
 {
-    std::stringstream ss;
+    // The whole stream in one go: straight from the mapping when its sectors are contiguous
     POLE::Stream requested_stream(m_File, stream);
     if (requested_stream.fail())
-        std::cout << "Failed to obtain stream: " << stream << '\n';
-    else {
-        uint64_t microt;
-        uint32_t address = 0;
-        int read;
-        do {
-            read = requested_stream.read(reinterpret_cast<unsigned char*>(&address), 4);
-        } while (read > 0 && address != 0x00390040u && address != 0x0E060040u && address != 0x80080040u);
-
-        if (address == 0x00390040u || address == 0x0E060040u || address == 0x80080040u) {
-            requested_stream.read(reinterpret_cast<unsigned char*>(&address), 4);
-            requested_stream.read(reinterpret_cast<unsigned char*>(&microt), 8);
-
-            microt = microt / 10;
-
-            std::tm t;
-            t.tm_year = 1601 - 1900;
-            t.tm_mday = 1;
-            t.tm_mon  = 0;
-            t.tm_hour = 0;
-            t.tm_min  = 0;
-            t.tm_sec  = 0;
-
-            std::time_t pTypTime = std::mktime(&t); // PTypTime() ==
-                                                    // 01/01/1601
-                                                    // 00:00:00.
-
-            std::chrono::system_clock::time_point tpDate =
-                (std::chrono::system_clock::from_time_t(pTypTime) + std::chrono::microseconds(microt));
-            std::time_t ttDate = std::chrono::system_clock::to_time_t(tpDate);
-
-            t = *(std::localtime(&ttDate));
-
-            ss << std::setw(4) << std::setfill('0') << t.tm_year + 1900 << '-' << std::setw(2)
-               << std::setfill('0') << t.tm_mon + 1 << '-' << std::setw(2) << std::setfill('0') << t.tm_mday;
-        }
-    }
-    return ss.str();
+        return std::string_view();
+    return getStringFromBytes(requested_stream.view());
 }
 
-const std::string Msg::getStringFromStream(const char* stream)
+// Converts the raw UTF-16LE contents of a PT_UNICODE stream to UTF-8 in the arena, without its terminator
+std::string_view Msg::getStringFromBytes(POLE::ByteSpan bytes)
 {
-    std::u16string helper;
-    std::string ret;
-    unsigned char buffer[16];
-    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
+    std::size_t len = static_cast<std::size_t>(bytes.size) & ~static_cast<std::size_t>(1);
+    if (len >= 2 && bytes.data[len - 2] == 0 && bytes.data[len - 1] == 0)
+        len -= 2;
+    if (len == 0)
+        return std::string_view();
+    char* text       = arena().allocate(len / 2 * 3);
+    std::size_t used = Utils::utf16le_to_utf8(bytes.data, len, text);
+    arena().shrink(text, used);
+    return std::string_view(text, used);
+}
 
-    POLE::Stream requested_stream(m_File, stream);
-    if (!requested_stream.fail()) {
-        int read;
-        ret.reserve(requested_stream.size() / 2);
-        helper.reserve(requested_stream.size() / 2);
-
-        do {
-            read = requested_stream.read(buffer, sizeof(buffer));
-            helper.insert(helper.length(), reinterpret_cast<char16_t*>(buffer), read / 2);
-        } while (read >= sizeof(buffer));
-        if (helper.length() > 0)
-            if (helper.at(helper.length() - 1) == (char16_t)0)
-                helper.resize(helper.length() - 1);
-        ret = converter.to_bytes(helper);
+// Converts the contents of a PT_STRING8 stream, in the message code page, to UTF-8 in the arena
+std::string_view Msg::getString8FromBytes(POLE::ByteSpan bytes)
+{
+    std::size_t len = static_cast<std::size_t>(bytes.size);
+    while (len > 0 && bytes.data[len - 1] == 0) --len;
+    if (len == 0)
+        return std::string_view();
+    char* text       = arena().allocate(len * 3);
+    std::size_t used = Utils::codepage_to_utf8(m_Codepage, bytes.data, len, text);
+    arena().shrink(text, used);
+    return std::string_view(text, used);
+}
+
+Arena& Msg::arena()
+{
+    if (!m_Arena) {
+        m_OwnArena.reset(new Arena());
+        m_Arena = m_OwnArena.get();
     }
-    return ret;
+    return *m_Arena;
 }
 
 // Destructor
@@ -308,22 +979,38 @@ Msg::~Msg()
 
 // Move semantics
 Msg::Msg(Msg&& rhs)
-    : m_Opened(std::move(rhs.m_Opened)), m_FileName(std::move(rhs.m_FileName)),
-      m_SenderName(std::move(rhs.m_SenderName)), m_SenderAddress(std::move(rhs.m_SenderAddress)),
+    : m_Buffer(std::move(rhs.m_Buffer)), m_Arena(rhs.m_Arena), m_OwnArena(std::move(rhs.m_OwnArena)),
+      m_Opened(std::move(rhs.m_Opened)), m_Error(rhs.m_Error), m_Fields(rhs.m_Fields),
+      m_FileName(std::move(rhs.m_FileName)), m_SenderName(std::move(rhs.m_SenderName)),
+      m_SenderAddress(std::move(rhs.m_SenderAddress)),
       m_ReceiversNames(std::move(rhs.m_ReceiversNames)),
       m_ReceiversAddresses(std::move(rhs.m_ReceiversAddresses)), m_Subject(std::move(rhs.m_Subject)),
       m_CC(std::move(rhs.m_CC)), m_Bcc(std::move(rhs.m_Bcc)), m_date(std::move(rhs.m_date)),
       m_body(std::move(rhs.m_body)), m_hash(std::move(rhs.m_hash)),
-      m_hasAttachments(std::move(rhs.m_hasAttachments))
+      m_contentHash(std::move(rhs.m_contentHash)), m_HashAlgorithm(rhs.m_HashAlgorithm),
+      m_Properties(std::move(rhs.m_Properties)),
+      m_Recipients(std::move(rhs.m_Recipients)), m_Attachments(std::move(rhs.m_Attachments)),
+      m_SentTime(rhs.m_SentTime), m_hasSentTime(rhs.m_hasSentTime),
+      m_hasAttachments(std::move(rhs.m_hasAttachments)), m_Codepage(rhs.m_Codepage),
+      m_BodyStreams(rhs.m_BodyStreams)
 {
-    m_File     = rhs.m_File;
-    rhs.m_File = nullptr;
+    m_File       = rhs.m_File;
+    rhs.m_File   = nullptr;
+    rhs.m_Arena  = nullptr;
+    rhs.m_Opened = false;
 }
 
 Msg& Msg::operator=(Msg&& rhs)
 {
     if (this != &rhs) {
+        close();
+        m_Buffer             = std::move(rhs.m_Buffer);
+        m_Arena              = rhs.m_Arena;
+        m_OwnArena           = std::move(rhs.m_OwnArena);
+        rhs.m_Arena          = nullptr;
         m_Opened             = std::move(rhs.m_Opened);
+        m_Error              = rhs.m_Error;
+        m_Fields             = rhs.m_Fields;
         m_FileName           = std::move(rhs.m_FileName);
         m_SenderName         = std::move(rhs.m_SenderName);
         m_SenderAddress      = std::move(rhs.m_SenderAddress);
@@ -335,9 +1022,19 @@ Msg& Msg::operator=(Msg&& rhs)
         m_date               = std::move(rhs.m_date);
         m_body               = std::move(rhs.m_body);
         m_hash               = std::move(rhs.m_hash);
+        m_contentHash        = std::move(rhs.m_contentHash);
+        m_HashAlgorithm      = rhs.m_HashAlgorithm;
+        m_Properties         = std::move(rhs.m_Properties);
+        m_Recipients         = std::move(rhs.m_Recipients);
+        m_Attachments        = std::move(rhs.m_Attachments);
+        m_SentTime           = rhs.m_SentTime;
+        m_hasSentTime        = rhs.m_hasSentTime;
         m_hasAttachments     = std::move(rhs.m_hasAttachments);
+        m_Codepage           = rhs.m_Codepage;
+        m_BodyStreams        = rhs.m_BodyStreams;
         m_File               = rhs.m_File;
         rhs.m_File           = nullptr;
+        rhs.m_Opened         = false;
     }
     return *this;
 }
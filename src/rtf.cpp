@@ -0,0 +1,687 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+#include "rtf.h"
+#include "unicode.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Utils
+{
+namespace
+{
+// PR_RTF_COMPRESSED starts with a header of four little-endian DWORDs: compressed size (counting the
+// bytes after itself), raw size, compression type and CRC
+const std::size_t HeaderSize      = 16;
+const uint32_t CompressedMagic   = 0x75465A4C; // "LZFu"
+const uint32_t UncompressedMagic = 0x414C454D; // "MELA"
+
+// Initial contents of the 4 KB LZFu dictionary, [MS-OXRTFCP] 2.1.2.1
+const char Prebuf[] = "{\\rtf1\\ansi\\mac\\deff0\\deftab720{\\fonttbl;}{\\f0\\fnil \\froman \\fswiss "
+                      "\\fmodern \\fscript \\fdecor MS Sans SerifSymbolArialTimes New RomanCourier"
+                      "{\\colortbl\\red0\\green0\\blue0\r\n\\par \\pard\\plain\\f0\\fs20\\b\\i\\u\\tab\\tx";
+const unsigned PrebufSize     = sizeof(Prebuf) - 1;
+const unsigned DictionarySize = 4096;
+
+uint32_t readU32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void appendUtf8(std::string& out, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+bool isAlpha(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool isDigit(unsigned char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int hexValue(unsigned char c)
+{
+    if (isDigit(c))
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool isOneOf(const std::string& word, const char* const* words)
+{
+    for (; *words; ++words)
+        if (word == *words)
+            return true;
+    return false;
+}
+
+// Feeds every byte of the decompressed stream to sink.put(), returns false on malformed input
+template <class Sink>
+bool decompress(const unsigned char* data, std::size_t len, Sink& sink)
+{
+    if (len < HeaderSize)
+        return false;
+    const uint32_t compressedSize = readU32(data);
+    const uint32_t rawSize        = readU32(data + 4);
+    const uint32_t magic          = readU32(data + 8);
+    const std::size_t end = compressedSize + 4u < len ? compressedSize + 4u : len;
+
+    if (magic == UncompressedMagic) {
+        for (std::size_t pos = HeaderSize; pos < end; ++pos) sink.put(data[pos]);
+        return end == compressedSize + 4u;
+    }
+    if (magic != CompressedMagic)
+        return false;
+
+    unsigned char dictionary[DictionarySize];
+    std::memcpy(dictionary, Prebuf, PrebufSize);
+    std::memset(dictionary + PrebufSize, 0, DictionarySize - PrebufSize);
+    unsigned write    = PrebufSize;
+    uint32_t produced = 0;
+
+    // Each control byte tells, from its lowest bit up, whether the next 8 tokens are literal bytes or
+    // 16-bit big-endian references: a 12-bit dictionary offset and a 4-bit length minus 2.
+    std::size_t pos = HeaderSize;
+    while (pos < end) {
+        unsigned control = data[pos++];
+        for (int token = 0; token < 8 && pos < end; ++token, control >>= 1) {
+            if (!(control & 1)) {
+                const unsigned char c = data[pos++];
+                dictionary[write]     = c;
+                write                 = (write + 1) % DictionarySize;
+                sink.put(c);
+                if (++produced >= rawSize)
+                    return true;
+                continue;
+            }
+            if (pos + 2 > end)
+                return false;
+            const unsigned reference = (data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            const unsigned offset = reference >> 4;
+            const unsigned length = (reference & 0x0F) + 2;
+            if (offset == write) // end of the stream
+                return true;
+            for (unsigned i = 0; i < length; ++i) {
+                const unsigned char c = dictionary[(offset + i) % DictionarySize];
+                dictionary[write]     = c;
+                write                 = (write + 1) % DictionarySize;
+                sink.put(c);
+                if (++produced >= rawSize)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+struct StringSink
+{
+    std::string& out;
+    void put(unsigned char c) { out.push_back(static_cast<char>(c)); }
+};
+
+// Push parser reducing HTML to text, one byte at a time
+class HtmlText
+{
+  public:
+    explicit HtmlText(std::string& out) : m_Out(out) {}
+
+    void put(unsigned char c)
+    {
+        switch (m_State) {
+        case Text:
+            if (c == '<') {
+                m_State = TagStart;
+                m_Name.clear();
+                m_Closing = false;
+            } else if (c == '&' && m_SkipUntil.empty()) {
+                m_State = Entity;
+                m_Entity.clear();
+            } else {
+                text(c);
+            }
+            break;
+        case TagStart:
+            if (c == '/') {
+                m_Closing = true;
+            } else if (c == '!') {
+                m_State = Declaration;
+                m_Dashes = 0;
+            } else if (isAlpha(c)) {
+                m_Name.push_back(static_cast<char>(c | 0x20));
+                m_State = TagName;
+            } else {
+                // Not a tag after all
+                m_State = Text;
+                text('<');
+                put(c);
+            }
+            break;
+        case TagName:
+            if (isAlpha(c) || isDigit(c)) {
+                if (m_Name.size() < 16)
+                    m_Name.push_back(static_cast<char>(isAlpha(c) ? c | 0x20 : c));
+                break;
+            }
+            m_State = TagRest;
+            m_Quote = 0;
+            put(c);
+            break;
+        case TagRest:
+            if (m_Quote) {
+                if (c == m_Quote)
+                    m_Quote = 0;
+            } else if (c == '"' || c == '\'') {
+                m_Quote = c;
+            } else if (c == '>') {
+                m_State = Text;
+                tag();
+            }
+            break;
+        case Declaration:
+            // <!DOCTYPE ...>, or the start of a <!-- comment -->
+            if (c == '>') {
+                m_State = Text;
+            } else if (m_Dashes >= 0 && c == '-') {
+                if (++m_Dashes == 2) {
+                    m_State  = Comment;
+                    m_Dashes = 0;
+                }
+            } else {
+                m_Dashes = -1;
+            }
+            break;
+        case Comment:
+            if (c == '-')
+                ++m_Dashes;
+            else if (c == '>' && m_Dashes >= 2)
+                m_State = Text;
+            else
+                m_Dashes = 0;
+            break;
+        case Entity:
+            if (c == ';') {
+                m_State = Text;
+                entity();
+            } else if ((isAlpha(c) || isDigit(c) || c == '#') && m_Entity.size() < 10) {
+                m_Entity.push_back(static_cast<char>(c));
+            } else {
+                m_State = Text;
+                text('&');
+                for (char e : m_Entity) text(static_cast<unsigned char>(e));
+                put(c);
+            }
+            break;
+        }
+    }
+
+    void finish()
+    {
+        if (m_State == Entity) {
+            m_State = Text;
+            text('&');
+            for (char e : m_Entity) text(static_cast<unsigned char>(e));
+        }
+    }
+
+  private:
+    enum State { Text, TagStart, TagName, TagRest, Declaration, Comment, Entity };
+
+    void text(unsigned char c)
+    {
+        if (!m_SkipUntil.empty())
+            return;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f') {
+            m_Space = true;
+            return;
+        }
+        if (m_Space && !m_Out.empty() && m_Out.back() != '\n')
+            m_Out.push_back(' ');
+        m_Space = false;
+        m_Out.push_back(static_cast<char>(c));
+    }
+
+    void codePoint(uint32_t cp)
+    {
+        if (cp == 0xA0) {
+            text(' ');
+            return;
+        }
+        std::string bytes;
+        appendUtf8(bytes, cp);
+        for (char b : bytes) text(static_cast<unsigned char>(b));
+    }
+
+    void newline()
+    {
+        if (m_SkipUntil.empty() && !m_Out.empty() && m_Out.back() != '\n')
+            m_Out.push_back('\n');
+        m_Space = false;
+    }
+
+    void tag()
+    {
+        static const char* const hidden[] = {"head", "style", "script", "title", nullptr};
+        static const char* const blocks[] = {"p",  "br", "div", "tr", "li", "h1",         "h2",    "h3",
+                                             "h4", "h5", "h6",  "hr", "ul", "ol", "blockquote", "table",
+                                             "pre", nullptr};
+        if (isOneOf(m_Name, hidden)) {
+            if (!m_Closing && m_SkipUntil.empty())
+                m_SkipUntil = m_Name;
+            else if (m_Closing && m_SkipUntil == m_Name)
+                m_SkipUntil.clear();
+        } else if (isOneOf(m_Name, blocks)) {
+            newline();
+        } else if (m_Name == "td" || m_Name == "th") {
+            m_Space = true;
+        }
+    }
+
+    void entity()
+    {
+        struct Named
+        {
+            const char* name;
+            uint16_t cp;
+        };
+        static const Named named[] = {
+            {"amp", '&'},       {"lt", '<'},       {"gt", '>'},       {"quot", '"'},     {"apos", '\''},
+            {"nbsp", 0xA0},     {"copy", 0xA9},    {"reg", 0xAE},     {"trade", 0x2122}, {"euro", 0x20AC},
+            {"hellip", 0x2026}, {"ndash", 0x2013}, {"mdash", 0x2014}, {"lsquo", 0x2018}, {"rsquo", 0x2019},
+            {"ldquo", 0x201C},  {"rdquo", 0x201D}, {"bull", 0x2022},  {"middot", 0xB7},  {"laquo", 0xAB},
+            {"raquo", 0xBB}};
+
+        if (m_Entity.size() > 1 && m_Entity[0] == '#') {
+            uint32_t cp = 0;
+            bool hex    = m_Entity[1] == 'x' || m_Entity[1] == 'X';
+            for (std::size_t i = hex ? 2 : 1; i < m_Entity.size(); ++i) {
+                int digit = hex ? hexValue(m_Entity[i]) : (isDigit(m_Entity[i]) ? m_Entity[i] - '0' : -1);
+                if (digit < 0 || cp > 0x10FFFF) {
+                    cp = 0xFFFD;
+                    break;
+                }
+                cp = cp * (hex ? 16 : 10) + digit;
+            }
+            codePoint(cp == 0 || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF) ? 0xFFFD : cp);
+            return;
+        }
+        for (const Named& n : named)
+            if (m_Entity == n.name) {
+                codePoint(n.cp);
+                return;
+            }
+        text('&');
+        for (char e : m_Entity) text(static_cast<unsigned char>(e));
+        text(';');
+    }
+
+    std::string& m_Out;
+    State m_State = Text;
+    std::string m_Name;
+    std::string m_Entity;
+    std::string m_SkipUntil; // hidden element being skipped
+    unsigned char m_Quote = 0;
+    int m_Dashes          = 0;
+    bool m_Closing        = false;
+    bool m_Space          = false;
+};
+
+// Push parser reducing RTF to text, one byte at a time. In RTF-encapsulated HTML the HTML is rebuilt
+// from the \*\htmltag groups and the text outside \htmlrtf blocks, and handed to an HtmlText.
+class RtfText
+{
+  public:
+    explicit RtfText(std::string& out) : m_Out(out), m_Html(out) {}
+
+    void put(unsigned char c)
+    {
+        switch (m_State) {
+        case Text:
+            switch (c) {
+            case '{':
+                m_Groups.push_back(m_Group);
+                m_GroupStart = true;
+                m_Star       = false;
+                break;
+            case '}':
+                if (!m_Groups.empty()) {
+                    m_Group = m_Groups.back();
+                    m_Groups.pop_back();
+                }
+                m_GroupStart = false;
+                m_SkipChars  = 0;
+                break;
+            case '\\':
+                m_State = Escape;
+                break;
+            case '\r':
+            case '\n':
+                break;
+            default:
+                m_GroupStart = false;
+                character(c);
+                break;
+            }
+            break;
+        case Escape:
+            if (isAlpha(c)) {
+                m_Word.assign(1, static_cast<char>(c));
+                m_Param    = 0;
+                m_HasParam = false;
+                m_Negative = false;
+                m_State    = Word;
+                break;
+            }
+            m_State = Text;
+            symbol(c);
+            break;
+        case Word:
+            if (isAlpha(c)) {
+                if (m_Word.size() < 32)
+                    m_Word.push_back(static_cast<char>(c));
+            } else if (isDigit(c) || c == '-') {
+                m_Negative = c == '-';
+                m_Param    = m_Negative ? 0 : c - '0';
+                m_HasParam = !m_Negative;
+                m_State    = Param;
+            } else {
+                endWord(c);
+            }
+            break;
+        case Param:
+            if (isDigit(c)) {
+                if (m_Param < 100000000)
+                    m_Param = m_Param * 10 + (c - '0');
+                m_HasParam = true;
+            } else {
+                endWord(c);
+            }
+            break;
+        case Hex:
+            if (hexValue(c) < 0) {
+                m_State = Text;
+                break;
+            }
+            m_Hex = m_Hex * 16 + hexValue(c);
+            if (++m_HexDigits == 2) {
+                m_State = Text;
+                character(static_cast<unsigned char>(m_Hex));
+            }
+            break;
+        case Binary:
+            if (--m_BinaryLeft <= 0)
+                m_State = Text;
+            break;
+        }
+    }
+
+    void finish() { m_Html.finish(); }
+
+  private:
+    enum State { Text, Escape, Word, Param, Hex, Binary };
+    enum Mode { Native, FromText, FromHtml };
+
+    struct Group
+    {
+        bool skip    = false; // destination without text
+        bool htmlrtf = false; // RTF only rendering of encapsulated content
+        bool htmltag = false; // \*\htmltag: HTML source
+        int uc       = 1;     // characters following \uN that stand in for it
+    };
+
+    bool visible() const { return !m_Group.skip && (m_Group.htmltag || !m_Group.htmlrtf); }
+
+    void emit(uint32_t cp)
+    {
+        if (m_Mode == FromHtml) {
+            std::string bytes;
+            appendUtf8(bytes, cp);
+            for (char b : bytes) m_Html.put(static_cast<unsigned char>(b));
+        } else {
+            appendUtf8(m_Out, cp);
+        }
+    }
+
+    // A text byte, or a \'hh byte, in the document code page
+    void character(unsigned char c)
+    {
+        if (m_SkipChars > 0) {
+            --m_SkipChars;
+            return;
+        }
+        if (!visible())
+            return;
+        emit(codepage_code_point(m_Codepage, c));
+    }
+
+    void symbol(unsigned char c)
+    {
+        switch (c) {
+        case '\'':
+            m_State     = Hex;
+            m_Hex       = 0;
+            m_HexDigits = 0;
+            break;
+        case '\\':
+        case '{':
+        case '}':
+            m_GroupStart = false;
+            character(c);
+            break;
+        case '*':
+            m_Star = m_GroupStart;
+            break;
+        case '~':
+            m_GroupStart = false;
+            character(' ');
+            break;
+        case '_':
+            m_GroupStart = false;
+            character('-');
+            break;
+        case '\r':
+        case '\n':
+            m_GroupStart = false;
+            if (visible())
+                emit('\n');
+            break;
+        default:
+            m_GroupStart = false;
+            break;
+        }
+    }
+
+    void endWord(unsigned char delimiter)
+    {
+        m_State = Text;
+        if (m_Negative)
+            m_Param = -m_Param;
+        control();
+        // A space ends the control word, anything else is content of its own
+        if (delimiter != ' ')
+            put(delimiter);
+    }
+
+    void control()
+    {
+        static const char* const destinations[] = {
+            "fonttbl", "colortbl", "stylesheet", "info", "pict", "object", "header", "footer", "headerl",
+            "headerr", "footerl", "footerr", "fldinst", "themedata", "datastore", "latentstyles", "listtable",
+            "listoverridetable", "rsidtbl", "generator", "xmlnstbl", "filetbl", "revtbl",
+            "colorschememapping", "private", nullptr};
+
+        const bool groupStart = m_GroupStart;
+        const bool star       = m_Star;
+        m_GroupStart          = false;
+        m_Star                = false;
+
+        if (m_Word == "bin") {
+            m_BinaryLeft = m_Param;
+            if (m_BinaryLeft > 0)
+                m_State = Binary;
+            return;
+        }
+        if (groupStart && star) {
+            if (m_Word == "htmltag" && m_Mode == FromHtml) {
+                m_Group.htmltag = true;
+                m_Group.htmlrtf = false;
+            } else {
+                m_Group.skip = true;
+            }
+            return;
+        }
+        if (groupStart && isOneOf(m_Word, destinations)) {
+            m_Group.skip = true;
+            return;
+        }
+
+        if (m_Word == "fromhtml") {
+            m_Mode = m_Param ? FromHtml : m_Mode;
+        } else if (m_Word == "fromtext") {
+            m_Mode = FromText;
+        } else if (m_Word == "htmlrtf") {
+            m_Group.htmlrtf = !(m_HasParam && m_Param == 0);
+        } else if (m_Word == "ansicpg") {
+            m_Codepage = m_Param > 0 ? static_cast<unsigned>(m_Param) : DefaultCodepage;
+        } else if (m_Word == "uc") {
+            m_Group.uc = m_Param >= 0 ? static_cast<int>(m_Param) : 1;
+        } else if (m_Word == "u") {
+            unicode(static_cast<uint32_t>(m_Param < 0 ? m_Param + 65536 : m_Param));
+        } else if (m_Word == "par" || m_Word == "line" || m_Word == "row" || m_Word == "sect" ||
+                   m_Word == "page") {
+            if (visible())
+                emit('\n');
+        } else if (m_Word == "tab" || m_Word == "cell") {
+            if (visible())
+                emit('\t');
+        } else if (visible()) {
+            static const struct
+            {
+                const char* word;
+                uint16_t cp;
+            } symbols[] = {{"emdash", 0x2014},    {"endash", 0x2013}, {"bullet", 0x2022},
+                           {"lquote", 0x2018},    {"rquote", 0x2019}, {"ldblquote", 0x201C},
+                           {"rdblquote", 0x201D}, {"emspace", ' '},   {"enspace", ' '},
+                           {"qmspace", ' '}};
+            for (const auto& symbol : symbols)
+                if (m_Word == symbol.word) {
+                    emit(symbol.cp);
+                    break;
+                }
+        }
+    }
+
+    void unicode(uint32_t unit)
+    {
+        m_SkipChars = m_Group.uc;
+        if (!visible())
+            return;
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            m_HighSurrogate = unit;
+            return;
+        }
+        if (unit >= 0xDC00 && unit <= 0xDFFF) {
+            if (m_HighSurrogate)
+                emit(0x10000 + ((m_HighSurrogate - 0xD800) << 10) + (unit - 0xDC00));
+            else
+                emit(0xFFFD);
+            m_HighSurrogate = 0;
+            return;
+        }
+        if (m_HighSurrogate)
+            emit(0xFFFD);
+        m_HighSurrogate = 0;
+        emit(unit);
+    }
+
+    std::string& m_Out;
+    HtmlText m_Html;
+    State m_State       = Text;
+    Mode m_Mode         = Native;
+    unsigned m_Codepage = DefaultCodepage; // \ansicpg
+    Group m_Group;
+    std::vector<Group> m_Groups;
+    bool m_GroupStart = false; // nothing but \* read since the last '{'
+    bool m_Star       = false;
+    std::string m_Word;
+    long m_Param             = 0;
+    bool m_HasParam          = false;
+    bool m_Negative          = false;
+    int m_Hex                = 0;
+    int m_HexDigits          = 0;
+    int m_SkipChars          = 0;
+    long m_BinaryLeft        = 0;
+    uint32_t m_HighSurrogate = 0;
+};
+}
+
+bool lzfu_decompress(const unsigned char* data, std::size_t len, std::string& rtf)
+{
+    StringSink sink{rtf};
+    return decompress(data, len, sink);
+}
+
+void rtf_to_text(const char* rtf, std::size_t len, std::string& text)
+{
+    RtfText parser(text);
+    for (std::size_t i = 0; i < len; ++i) parser.put(static_cast<unsigned char>(rtf[i]));
+    parser.finish();
+}
+
+bool compressed_rtf_to_text(const unsigned char* data, std::size_t len, std::string& text)
+{
+    RtfText parser(text);
+    bool ok = decompress(data, len, parser);
+    parser.finish();
+    return ok;
+}
+
+void html_to_text(const char* html, std::size_t len, std::string& text)
+{
+    HtmlText parser(text);
+    for (std::size_t i = 0; i < len; ++i) parser.put(static_cast<unsigned char>(html[i]));
+    parser.finish();
+}
+}
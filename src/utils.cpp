@@ -24,6 +24,8 @@
 #include <sstream>
 #include <fstream>
 #include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -32,6 +34,11 @@
 #include <boost/archive/iterators/binary_from_base64.hpp>
 #include <boost/archive/iterators/base64_from_binary.hpp>
 
+#include "md5.hh"
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
 namespace Utils
 {
 std::string base64_decode(const std::string& val)
@@ -64,6 +71,37 @@ std::string string_compress_encode_file(const std::string& filename)
     return compressed_encoded;
 }
 
+std::string string_compress_encode(const std::string& data)
+{
+    return string_compress_encode(data.data(), data.size());
+}
+
+std::string string_compress_encode(const char* data, std::size_t size)
+{
+    std::stringstream compressed;
+
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> out;
+    out.push(boost::iostreams::bzip2_compressor());
+    out.push(boost::iostreams::array_source(data, size));
+    boost::iostreams::copy(out, compressed);
+
+    return base64_encode(compressed.str());
+}
+
+std::string string_decompress_decode(const std::string& data)
+{
+    std::stringstream compressed_stream;
+    std::string decompressed;
+    compressed_stream.str(base64_decode(data));
+
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
+    in.push(boost::iostreams::bzip2_decompressor());
+    in.push(compressed_stream);
+    boost::iostreams::copy(in, boost::iostreams::back_inserter(decompressed));
+
+    return decompressed;
+}
+
 void string_decompress_decode_to_file(const std::string& data, const std::string& filename)
 {
     std::stringstream compressed_stream;
@@ -76,4 +114,110 @@ void string_decompress_decode_to_file(const std::string& data, const std::string
     in.push(compressed_stream);
     boost::iostreams::copy(in, decompressed);
 }
+
+std::string md5_hex(const unsigned char* data, std::size_t len)
+{
+    MD5 md5;
+    char* bytes = reinterpret_cast<char*>(const_cast<unsigned char*>(data));
+    while (len > 0) {
+        unsigned int chunk = len > 0x40000000u ? 0x40000000u : static_cast<unsigned int>(len);
+        md5.update(bytes, chunk);
+        bytes += chunk;
+        len -= chunk;
+    }
+    md5.finalize();
+    char* digest = md5.hex_digest();
+    std::string hex(digest);
+    delete[] digest;
+    return hex;
+}
+
+namespace
+{
+std::string xxh128_hex(XXH128_hash_t hash)
+{
+    XXH128_canonical_t canonical;
+    XXH128_canonicalFromHash(&canonical, hash);
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(2 * sizeof(canonical.digest), '\0');
+    for (std::size_t i = 0; i < sizeof(canonical.digest); ++i) {
+        hex[2 * i]     = digits[canonical.digest[i] >> 4];
+        hex[2 * i + 1] = digits[canonical.digest[i] & 0x0F];
+    }
+    return hex;
+}
+}
+
+std::string xxh3_128_hex(const unsigned char* data, std::size_t len)
+{
+    return xxh128_hex(XXH3_128bits(data, len));
+}
+
+std::string content_hash_hex(HashAlgorithm algorithm, const unsigned char* data, std::size_t len)
+{
+    switch (algorithm) {
+    case HashAlgorithm::XXH3_128:
+        return xxh3_128_hex(data, len);
+    case HashAlgorithm::MD5:
+    default:
+        return md5_hex(data, len);
+    }
+}
+
+struct ContentHasher::State
+{
+    MD5 md5;
+    XXH3_state_t xxh3;
+};
+
+ContentHasher::ContentHasher(HashAlgorithm algorithm) : m_Algorithm(algorithm), m_State(new State)
+{
+    if (m_Algorithm == HashAlgorithm::XXH3_128)
+        XXH3_128bits_reset(&m_State->xxh3);
+}
+
+ContentHasher::~ContentHasher() = default;
+
+void ContentHasher::update(const unsigned char* data, std::size_t len)
+{
+    if (m_Algorithm == HashAlgorithm::XXH3_128) {
+        XXH3_128bits_update(&m_State->xxh3, data, len);
+        return;
+    }
+    char* bytes = reinterpret_cast<char*>(const_cast<unsigned char*>(data));
+    while (len > 0) {
+        unsigned int chunk = len > 0x40000000u ? 0x40000000u : static_cast<unsigned int>(len);
+        m_State->md5.update(bytes, chunk);
+        bytes += chunk;
+        len -= chunk;
+    }
+}
+
+std::string ContentHasher::hexDigest()
+{
+    if (m_Algorithm == HashAlgorithm::XXH3_128)
+        return xxh128_hex(XXH3_128bits_digest(&m_State->xxh3));
+    m_State->md5.finalize();
+    char* digest = m_State->md5.hex_digest();
+    std::string hex(digest);
+    delete[] digest;
+    return hex;
+}
+
+const char* hash_algorithm_name(HashAlgorithm algorithm)
+{
+    return algorithm == HashAlgorithm::XXH3_128 ? "XXH3-128" : "MD5";
+}
+
+bool hash_algorithm_from_name(const std::string& name, HashAlgorithm& algorithm)
+{
+    if (name == "MD5")
+        algorithm = HashAlgorithm::MD5;
+    else if (name == "XXH3-128")
+        algorithm = HashAlgorithm::XXH3_128;
+    else
+        return false;
+    return true;
+}
 }
@@ -0,0 +1,270 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+// Parses the same corpus of .msg files on several threads at once and checks every thread gets
+// results bit-identical to a single threaded pass.
+//
+//     msg_stress [threads] [file.msg...]
+//
+// Without files a corpus is written to a temporary directory: Unicode and 8-bit messages, with
+// recipients, attachments and RTF-only bodies, plus a file that is not a compound file at all.
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local
+#include "arena.h"
+#include "msg.h"
+#include "pole.h"
+
+namespace
+{
+
+const int Rounds = 25;
+
+// Writes .msg streams with POLE, which creates the compound file
+class MsgWriter
+{
+  private:
+    POLE::Storage m_Storage;
+    bool m_Opened;
+
+  public:
+    explicit MsgWriter(const std::string& filename)
+        : m_Storage(filename.c_str()), m_Opened(m_Storage.open(true, true))
+    {
+    }
+    ~MsgWriter() { m_Storage.close(); }
+
+    bool opened() { return m_Opened; }
+
+    void put(const std::string& path, const std::string& bytes)
+    {
+        POLE::Stream stream(&m_Storage, path, true, bytes.size());
+        stream.write(reinterpret_cast<unsigned char*>(const_cast<char*>(bytes.data())), bytes.size());
+        stream.flush();
+    }
+
+    // A PT_UNICODE property from ASCII text
+    void putUnicode(const std::string& path, const std::string& text)
+    {
+        std::string bytes;
+        for (char c : text) {
+            bytes.push_back(c);
+            bytes.push_back('\0');
+        }
+        bytes.append(2, '\0');
+        put(path, bytes);
+    }
+};
+
+void appendLE(std::string& bytes, uint64_t value, int size)
+{
+    for (int i = 0; i < size; ++i)
+        bytes.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+// A properties stream holding PT_LONG values
+std::string properties(std::size_t headerSize, const std::vector<std::pair<uint16_t, uint32_t>>& values)
+{
+    std::string bytes(headerSize, '\0');
+    for (const auto& value : values) {
+        appendLE(bytes, (uint32_t(value.first) << 16) | 0x0003, 4);
+        appendLE(bytes, 6, 4);
+        appendLE(bytes, value.second, 8);
+    }
+    return bytes;
+}
+
+bool writeMessage(const std::string& filename, int n)
+{
+    MsgWriter msg(filename);
+    if (!msg.opened())
+        return false;
+
+    const bool eightBit = n % 3 == 1;
+    const std::string id = std::to_string(n);
+    std::vector<std::pair<uint16_t, uint32_t>> values = {{0x0E08, 4096u + n}, {0x0017, n % 3}};
+    if (eightBit) {
+        // Cyrillic in code page 1251, given by PR_INTERNET_CPID
+        values.push_back({0x3FDE, 1251});
+        msg.put("/__substg1.0_0037001E", "\xcf\xf0\xe8\xe2\xe5\xf2 " + id + std::string(1, '\0'));
+        msg.put("/__substg1.0_0C1A001E", "\xc0\xed\xed\xe0 " + id + std::string(1, '\0'));
+    } else {
+        msg.putUnicode("/__substg1.0_0037001F", "Subject of message " + id);
+        msg.putUnicode("/__substg1.0_0C1A001F", "Sender " + id);
+    }
+    msg.putUnicode("/__substg1.0_0065001F", "sender" + id + "@example.com");
+    msg.putUnicode("/__substg1.0_0E04001F", "Bob; Carol");
+    msg.put("/__properties_version1.0", properties(32, values));
+
+    if (n % 4 == 3) {
+        // RTF only, stored uncompressed
+        std::string rtf = "{\\rtf1\\ansi\\ansicpg1252 Body of message " + id + "\\par caf\\'e9}";
+        std::string stream;
+        appendLE(stream, rtf.size() + 12, 4);
+        appendLE(stream, rtf.size(), 4);
+        appendLE(stream, 0x414C454D, 4); // "MELA"
+        appendLE(stream, 0, 4);
+        msg.put("/__substg1.0_10090102", stream + rtf);
+    } else {
+        std::string body;
+        for (int line = 0; line < 50 * (n + 1); ++line)
+            body += "line " + std::to_string(line) + " of message " + id + "\r\n";
+        msg.putUnicode("/__substg1.0_1000001F", body);
+    }
+
+    for (int r = 0; r < n % 4 + 1; ++r) {
+        char storage[32];
+        std::snprintf(storage, sizeof(storage), "/__recip_version1.0_#%08X", r);
+        msg.putUnicode(std::string(storage) + "/__substg1.0_3001001F", "Recipient " + std::to_string(r));
+        msg.putUnicode(std::string(storage) + "/__substg1.0_39FE001F",
+                       "rcpt" + std::to_string(r) + "@example.com");
+        msg.put(std::string(storage) + "/__properties_version1.0", properties(8, {{0x0C15, r % 3 + 1}}));
+    }
+
+    for (int a = 0; a < n % 3; ++a) {
+        char storage[32];
+        std::snprintf(storage, sizeof(storage), "/__attach_version1.0_#%08X", a);
+        std::string data(1000 + 3000 * a + 37 * n, '\0');
+        uint32_t seed = n * 31 + a;
+        for (char& c : data) {
+            seed = seed * 1103515245u + 12345u;
+            c    = static_cast<char>(seed >> 16);
+        }
+        msg.put(std::string(storage) + "/__substg1.0_37010102", data);
+        msg.putUnicode(std::string(storage) + "/__substg1.0_3707001F", "file" + std::to_string(a) + ".bin");
+    }
+    return true;
+}
+
+// Everything a parse produces, so that any difference between two parses shows
+std::string digest(Core::Msg& msg)
+{
+    std::string d = std::to_string(static_cast<int>(msg.error()));
+    if (msg.error() != Core::Msg::Error::None)
+        return d;
+
+    for (const std::string& field : {msg.senderName(), msg.senderAddress(), msg.receiversNames(),
+                                     msg.receiversAddresses(), msg.CCs(), msg.Bccs(), msg.subject(),
+                                     msg.date(), msg.body(), msg.hash(), msg.contentHash()})
+        d += '|' + field;
+    d += '|' + std::to_string(msg.sentTime()) + '|' + std::to_string(msg.messageSize());
+    for (const Core::FixedProperty& property : msg.fixedProperties())
+        d += '|' + std::to_string(property.id) + ':' + std::to_string(property.value);
+    for (const Core::Recipient& recipient : msg.recipients())
+        d += '|' + std::to_string(recipient.type) + ':' + std::string(recipient.name) + ':' +
+             std::string(recipient.address);
+    for (const Core::Attachment& attachment : msg.attachments()) {
+        d += '|' + std::string(attachment.storage) + ':' + std::string(attachment.fileName) + ':' +
+             std::to_string(attachment.size) + ':' + msg.attachmentData(attachment);
+        for (const POLE::Extent& extent : attachment.extents)
+            d += ':' + std::to_string(extent.offset) + '+' + std::to_string(extent.length);
+    }
+    return d;
+}
+
+std::string readFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+}
+
+int main(int argc, char** argv)
+{
+    unsigned threads = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 0;
+    if (threads == 0)
+        threads = std::max(4u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> files(argv + std::min(argc, 2), argv + argc);
+    std::filesystem::path corpus;
+    if (files.empty()) {
+        corpus = std::filesystem::temp_directory_path() /
+                 ("msg_stress_" + std::to_string(std::random_device()()));
+        std::filesystem::create_directories(corpus);
+        for (int n = 0; n < 12; ++n) {
+            files.push_back((corpus / ("message" + std::to_string(n) + ".msg")).string());
+            if (!writeMessage(files.back(), n)) {
+                std::fprintf(stderr, "cannot write %s\n", files.back().c_str());
+                return EXIT_FAILURE;
+            }
+        }
+        files.push_back((corpus / "plain.txt").string());
+        std::ofstream(files.back()) << "Not a compound file, just some text long enough to be read.\n";
+    }
+
+    // The reference, parsed by a single thread
+    std::vector<std::string> expected;
+    std::vector<std::string> contents;
+    {
+        Core::Arena arena;
+        for (const std::string& filename : files) {
+            Core::Msg msg(filename, arena);
+            expected.push_back(digest(msg));
+            contents.push_back(readFile(filename));
+        }
+    }
+
+    // Each thread has its own arena and alternates between opening the files and their bytes
+    std::vector<int> mismatches(threads, 0);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            Core::Arena arena;
+            Core::Msg msg(arena);
+            for (int round = 0; round < Rounds; ++round)
+                for (std::size_t i = 0; i < files.size(); ++i) {
+                    std::size_t f = (i + t) % files.size();
+                    if ((round + t) % 2)
+                        msg.openBuffer(contents[f]);
+                    else
+                        msg.open(files[f].c_str());
+                    if (digest(msg) != expected[f])
+                        ++mismatches[t];
+                }
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+
+    if (!corpus.empty())
+        std::filesystem::remove_all(corpus);
+
+    int total = 0;
+    for (unsigned t = 0; t < threads; ++t) {
+        if (mismatches[t])
+            std::fprintf(stderr, "thread %u: %d mismatching parses\n", t, mismatches[t]);
+        total += mismatches[t];
+    }
+    std::printf("%zu files, %u threads, %d rounds: %d mismatches\n", files.size(), threads, Rounds, total);
+    return total == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
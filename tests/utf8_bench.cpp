@@ -0,0 +1,117 @@
+/**************************************************************************
+* Mail Archiver - A solution to store and manage offline e-mail files.    *
+* Copyright (C) 2015-2016 Carlos Nihelton <carlosnsoliveira@gmail.com>    *
+*                                                                         *
+* This is a free software; you can redistribute it and/or                 *
+* modify it under the terms of the GNU Library General Public             *
+* License as published by the Free Software Foundation; either            *
+* version 2 of the License, or (at your option) any later version.        *
+*                                                                         *
+* This software  is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+* GNU Library General Public License for more details.                    *
+*                                                                         *
+* You should have received a copy of the GNU Library General Public       *
+* License along with this library; see the file COPYING.LIB. If not,      *
+* write to the Free Software Foundation, Inc., 59 Temple Place,           *
+* Suite 330, Boston, MA  02111-1307, USA                                  *
+*                                                                         *
+**************************************************************************/
+
+// Compares Utils::utf16le_to_utf8 with the std::wstring_convert path Msg::getStringFromStream used
+// before it: both must give the same UTF-8, and the throughput of each is printed.
+//
+//     utf8_bench [rounds]
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <cstdlib>
+#include <locale>
+#include <random>
+#include <string>
+#include <vector>
+
+// local
+#include "unicode.h"
+
+namespace
+{
+
+// The former conversion: the stream is gathered into a u16string 16 bytes at a time, then converted
+std::string legacyConvert(const std::string& bytes)
+{
+    std::u16string helper;
+    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
+    helper.reserve(bytes.size() / 2);
+    for (std::size_t offset = 0; offset < bytes.size(); offset += 16) {
+        std::size_t read = std::min<std::size_t>(16, bytes.size() - offset);
+        helper.insert(helper.length(), reinterpret_cast<const char16_t*>(bytes.data() + offset), read / 2);
+    }
+    return converter.to_bytes(helper);
+}
+
+std::string simdConvert(const std::string& bytes)
+{
+    std::string text;
+    Utils::utf16le_to_utf8(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), text);
+    return text;
+}
+
+// A body of about 4 MB of UTF-16LE. asciiPercent of the characters are ASCII; the rest is spread
+// over Latin-1 accents, CJK and surrogate pairs.
+std::string makeBody(int asciiPercent)
+{
+    std::mt19937 rng(asciiPercent);
+    std::u16string text;
+    while (text.size() < 2000000) {
+        unsigned pick = rng() % 100;
+        if (pick < static_cast<unsigned>(asciiPercent))
+            text += static_cast<char16_t>(pick % 10 == 0 ? '\n' : 'a' + rng() % 26);
+        else if (pick % 3 == 0)
+            text += static_cast<char16_t>(0xC0 + rng() % 0x40);
+        else if (pick % 3 == 1)
+            text += static_cast<char16_t>(0x4E00 + rng() % 0x5000);
+        else {
+            text += static_cast<char16_t>(0xD800 + rng() % 0x400);
+            text += static_cast<char16_t>(0xDC00 + rng() % 0x400);
+        }
+    }
+    return std::string(reinterpret_cast<const char*>(text.data()), text.size() * 2);
+}
+
+template <typename Convert>
+double throughput(Convert convert, const std::string& bytes, int rounds, std::size_t& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+        checksum += convert(bytes).size();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return bytes.size() * double(rounds) / elapsed.count() / (1024 * 1024);
+}
+}
+
+int main(int argc, char** argv)
+{
+    const int rounds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 5;
+
+    int failures         = 0;
+    std::size_t checksum = 0;
+    std::printf("%-12s %14s %14s %8s\n", "input", "codecvt MB/s", "simd MB/s", "speedup");
+    for (int asciiPercent : {100, 99, 90, 50, 0}) {
+        std::string bytes = makeBody(asciiPercent);
+        if (simdConvert(bytes) != legacyConvert(bytes)) {
+            std::fprintf(stderr, "%d%% ASCII: the two conversions differ\n", asciiPercent);
+            ++failures;
+            continue;
+        }
+        double legacy = throughput(legacyConvert, bytes, rounds, checksum);
+        double simd   = throughput(simdConvert, bytes, rounds, checksum);
+        std::printf("%3d%% ASCII   %14.1f %14.1f %7.1fx\n", asciiPercent, legacy, simd, simd / legacy);
+    }
+    std::printf("(%zu bytes converted)\n", checksum);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}